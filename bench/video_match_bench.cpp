@@ -0,0 +1,239 @@
+// 匹配热点路径的微基准
+// 每个用例输出一行 JSON，便于脚本比较前后两次结果
+//
+// video_match_bench [-filter <string>] [-time <seconds>]
+//     -filter  只运行名称包含该字符串的用例
+//     -time    每个用例的最短计时，默认 0.2 秒
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <print>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "vm_frame.hpp"
+#include "vm_log.hpp"
+#include "vm_match.hpp"
+#include "vm_option.hpp"
+#include "vm_output.hpp"
+#include "vm_ssim.hpp"
+#include "vm_type.hpp"
+#include "vm_window.hpp"
+
+namespace {
+
+struct _resolution {
+  const char *name;
+  int width, height;
+};
+
+constexpr _resolution resolutions[] = {
+    {"480p", 854, 480}, {"1080p", 1920, 1080}, {"2160p", 3840, 2160}};
+constexpr double scales[] = {1, 1.5, 2, 4};
+constexpr int repeat = 5;
+
+std::string filter;
+double min_time = 0.2;
+// 被测函数使用的参数，只填写预处理尺寸
+vm_option::job job;
+// 防止被测代码的结果被优化掉
+volatile size_t sink;
+
+// 合成的 yuv420p 帧: 平滑渐变叠加伪随机噪声，seed 不同则噪声不同
+AVFrame *_make_frame(int width, int height, uint32_t seed) {
+  AVFrame *frame = av_frame_alloc();
+  frame->width = width;
+  frame->height = height;
+  frame->format = AV_PIX_FMT_YUV420P;
+  if (av_frame_get_buffer(frame, 64) < 0)
+    vm_log::errore("video_match_bench: av_frame_get_buffer: error");
+
+  uint32_t state = seed * 2654435761u + 1;
+  for (int y = 0; y < height; ++y) {
+    uint8_t *line = frame->data[0] + static_cast<ptrdiff_t>(y) *
+                                         frame->linesize[0];
+    for (int x = 0; x < width; ++x) {
+      state = state * 1664525u + 1013904223u;
+      line[x] = static_cast<uint8_t>((x * 255 / width + y * 255 / height) / 2 +
+                                     (state >> 28));
+    }
+  }
+  for (int plane = 1; plane < 3; ++plane)
+    for (int y = 0; y < (height + 1) / 2; ++y)
+      std::fill_n(frame->data[plane] +
+                      static_cast<ptrdiff_t>(y) * frame->linesize[plane],
+                  (width + 1) / 2, 128);
+  return frame;
+}
+
+void _set_size(const _resolution &resolution, double scale) {
+  job.frame_scale = scale;
+  job.new_width = static_cast<uint32_t>(resolution.width / scale);
+  job.new_height = static_cast<uint32_t>(resolution.height / scale);
+}
+
+// 重复调用 fn 至少 min_time 秒为一轮，输出 repeat 轮中每次调用的最短与中位耗时
+template <typename F>
+void _bench(const std::string &name, const std::string &params, F &&fn) {
+  if (!filter.empty() && name.find(filter) == std::string::npos)
+    return;
+
+  using clock = std::chrono::steady_clock;
+  fn(); // 预热
+
+  std::vector<double> ns_per_op;
+  uint64_t ops = 0;
+  for (int i = 0; i < repeat; ++i) {
+    uint64_t count = 0;
+    clock::time_point start = clock::now(), now;
+    do {
+      fn();
+      ++count;
+      now = clock::now();
+    } while (std::chrono::duration<double>(now - start).count() < min_time);
+    ns_per_op.push_back(std::chrono::duration<double, std::nano>(now - start)
+                            .count() /
+                        count);
+    ops += count;
+  }
+
+  std::sort(ns_per_op.begin(), ns_per_op.end());
+  std::println(R"({{"name": "{0}", {1}, "ops": {2}, "ns_per_op_min": {3:.1f}, )"
+               R"("ns_per_op_median": {4:.1f}}})",
+               name, params, ops, ns_per_op.front(),
+               ns_per_op[ns_per_op.size() / 2]);
+  std::fflush(stdout);
+}
+
+std::string _params(const _resolution &resolution, double scale) {
+  return std::format(R"("resolution": "{0}", "scale": {1}, "size": "{2}x{3}")",
+                     resolution.name, scale, job.new_width, job.new_height);
+}
+
+// 解码后的预处理: 转灰度、缩放、计算预筛选签名
+void _bench_process() {
+  for (const _resolution &resolution : resolutions) {
+    AVFrame *source = _make_frame(resolution.width, resolution.height, 1);
+    for (double scale : scales) {
+      _set_size(resolution, scale);
+      _bench("auto_pix_fmt_process", _params(resolution, scale),
+             [&] { delete vm_match::_auto_pix_fmt_process(job, source); });
+    }
+    av_frame_free(&source);
+  }
+}
+
+// 一次 SSIM 对比，以及预筛选上界
+void _bench_compare() {
+  for (const _resolution &resolution : resolutions) {
+    AVFrame *source_1 = _make_frame(resolution.width, resolution.height, 1);
+    AVFrame *source_2 = _make_frame(resolution.width, resolution.height, 2);
+    for (double scale : scales) {
+      _set_size(resolution, scale);
+      std::unique_ptr<vm_frame::frame> frame_1(
+          vm_match::_auto_pix_fmt_process(job, source_1));
+      std::unique_ptr<vm_frame::frame> frame_2(
+          vm_match::_auto_pix_fmt_process(job, source_2));
+
+      _bench("compare_ssim", _params(resolution, scale), [&] {
+        vm_match::compare_ssim(job, frame_1->gray, frame_2->gray, 0);
+      });
+      _bench("upper_bound", _params(resolution, scale), [&] {
+        vm_ssim::upper_bound(frame_1->sig, frame_2->sig);
+      });
+    }
+    av_frame_free(&source_1);
+    av_frame_free(&source_2);
+  }
+}
+
+// 窗口管理: 按 _flush_buffer 的节奏整段读入、移除旧帧，
+// 并像 _match_frame 一样遍历候选、消耗一帧，每次调用代表 video 1 的一帧
+void _bench_window() {
+  const fnum forward = job.frame_forward;
+  for (const _resolution &resolution : resolutions) {
+    AVFrame *source = _make_frame(resolution.width, resolution.height, 1);
+    for (double scale : scales) {
+      _set_size(resolution, scale);
+      std::unique_ptr<vm_frame::frame> frame(
+          vm_match::_auto_pix_fmt_process(job, source));
+      vm_window::window window(3 * static_cast<size_t>(forward) + 1,
+                               job.new_width, job.new_height);
+      fnum frame_num_1 = 0, read_pos = 0;
+      size_t candidates = 0;
+
+      _bench("window", _params(resolution, scale), [&] {
+        if (frame_num_1 + forward >= read_pos) {
+          for (fnum i = read_pos; i < read_pos + forward; ++i)
+            window.push(i, *frame);
+          read_pos += forward;
+        }
+        window.retire_before(frame_num_1 - forward);
+        for (fnum i = window.begin(); i < window.end(); ++i)
+          candidates += window.find(i) != nullptr;
+        window.consume(frame_num_1);
+        ++frame_num_1;
+      });
+      sink = candidates;
+    }
+    av_frame_free(&source);
+  }
+}
+
+// 丢弃写入内容，只计格式化与缓冲的开销
+class _null_buffer : public std::streambuf {
+protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char *, std::streamsize n) override {
+    return n;
+  }
+};
+
+// 输出格式化，每次调用写一帧，偏移每 1000 帧变化一次，其中夹杂未匹配帧
+void _bench_output() {
+  const std::pair<const char *, vm_option::output_type_enum> types[] = {
+      {"framenum", vm_option::output_type_enum::framenum},
+      {"ranges", vm_option::output_type_enum::ranges},
+      {"json", vm_option::output_type_enum::json},
+      {"binary", vm_option::output_type_enum::binary}};
+
+  for (const auto &[type_name, type] : types) {
+    _null_buffer null_buffer;
+    std::ostream stream(&null_buffer);
+    vm_output::writer writer(stream, type);
+    fnum frame_num = 0;
+
+    _bench("output", std::format(R"("type": "{0}")", type_name), [&] {
+      fnum block = frame_num / 1000;
+      writer.append(frame_num, block % 10 == 9 ? -1 : frame_num + block);
+      ++frame_num;
+    });
+    writer.finish();
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> args(argv, argv + argc);
+  args.push_back("");
+  for (size_t i = 1; i < args.size(); ++i) {
+    if (args[i] == "-filter")
+      filter = args[i + 1];
+    if (args[i] == "-time")
+      min_time = std::stod(args[i + 1]);
+  }
+
+  _bench_process();
+  _bench_compare();
+  _bench_window();
+  _bench_output();
+}
@@ -0,0 +1,384 @@
+// 端到端基准: 生成已知答案的视频对，运行匹配并统计速度与准确率
+//
+// video 2 为 libavfilter 源生成的原始序列，video 1 在其上做已知的编辑:
+// 删除帧、重复帧、插入其他源的帧、整体平移 (去掉开头若干帧)
+// 每组参数输出一行 JSON: 帧率、precision、recall
+//
+// video_match_corpus -o <dir> [options] [-- <video_match options>]
+//     -o        输出目录，写入 video_1.mkv video_2.mkv truth.txt result.bin
+//     -source   testsrc2 / mandelbrot / noise，默认 testsrc2
+//     -size     分辨率，可用逗号分隔多个，默认 1280x720
+//     -rate     帧率，默认 24
+//     -frames   原始序列帧数，默认 2000
+//     -drop -dup -insert <int>
+//               各类编辑的次数，默认各 20
+//     -shift    video 1 去掉开头的帧数，默认 12
+//     -seed     随机种子，默认 1
+//     -encoder  编码器，默认 libx264，不可用时使用 mpeg4
+//     --        之后的参数原样传给匹配
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+}
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <print>
+#include <random>
+#include <ranges>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "vm_log.hpp"
+#include "vm_match.hpp"
+#include "vm_option.hpp"
+#include "vm_type.hpp"
+#include "vm_utils.hpp"
+
+namespace {
+
+struct _config {
+  std::filesystem::path output_dir;
+  std::string source = "testsrc2";
+  std::vector<std::pair<int, int>> sizes{{1280, 720}};
+  int rate = 24;
+  fnum frames = 2000;
+  int drop = 20, dup = 20, insert = 20;
+  fnum shift = 12;
+  uint32_t seed = 1;
+  std::string encoder = "libx264";
+  std::vector<std::string> match_args;
+};
+
+// libavfilter 源的滤镜描述，输出 yuv420p
+std::string _source_graph(const std::string &source, int width, int height,
+                          int rate) {
+  std::string size = std::format("size={0}x{1}:rate={2}", width, height, rate);
+  if (source == "noise")
+    // 每帧的噪声都不同
+    return std::format("color=c=gray:{0},noise=alls=100:allf=t+u,"
+                       "format=yuv420p",
+                       size);
+  return std::format("{0}={1},format=yuv420p", source, size);
+}
+
+// 从只有源的滤镜图中逐帧读取
+class _source {
+public:
+  explicit _source(const std::string &description) {
+    graph = avfilter_graph_alloc();
+    if (!graph ||
+        avfilter_graph_create_filter(&sink, avfilter_get_by_name("buffersink"),
+                                     "out", nullptr, nullptr, graph) < 0)
+      vm_log::errore("video_match_corpus: failed to create buffer sink");
+
+    AVFilterInOut *inputs = avfilter_inout_alloc();
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = sink;
+    inputs->pad_idx = 0;
+    inputs->next = nullptr;
+    AVFilterInOut *outputs = nullptr;
+    if (avfilter_graph_parse_ptr(graph, description.c_str(), &inputs, &outputs,
+                                 nullptr) < 0 ||
+        avfilter_graph_config(graph, nullptr) < 0)
+      vm_log::errore(std::format(
+          "video_match_corpus: failed to configure \"{0}\"", description));
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+  }
+
+  ~_source() { avfilter_graph_free(&graph); }
+
+  _source(const _source &) = delete;
+  _source &operator=(const _source &) = delete;
+
+  // 返回的帧用 av_frame_free 释放
+  AVFrame *next() {
+    AVFrame *frame = av_frame_alloc();
+    if (av_buffersink_get_frame(sink, frame) < 0)
+      vm_log::errore("video_match_corpus: av_buffersink_get_frame: error");
+    return frame;
+  }
+
+private:
+  AVFilterGraph *graph = nullptr;
+  AVFilterContext *sink = nullptr;
+};
+
+// 编码并封装为一个视频文件，帧按写入顺序编号
+class _encoder {
+public:
+  _encoder(const std::filesystem::path &path, const _config &config, int width,
+           int height) {
+    std::string file = vm_utils::path_to_utf8(path);
+    if (avformat_alloc_output_context2(&format_ctx, nullptr, nullptr,
+                                       file.c_str()) < 0)
+      vm_log::errore(std::format(
+          "video_match_corpus: can not create output \"{0}\"", file));
+
+    const AVCodec *codec = avcodec_find_encoder_by_name(config.encoder.c_str());
+    if (!codec) {
+      vm_log::warning(std::format(
+          "video_match_corpus: encoder {0} not found, using mpeg4",
+          config.encoder));
+      codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    }
+    if (!codec)
+      vm_log::errore("video_match_corpus: no usable encoder");
+
+    codec_ctx = avcodec_alloc_context3(codec);
+    codec_ctx->width = width;
+    codec_ctx->height = height;
+    codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    codec_ctx->time_base = {1, config.rate};
+    codec_ctx->framerate = {config.rate, 1};
+    codec_ctx->gop_size = config.rate * 2;
+    // 足够高的码率，编码误差远小于 SSIM 阈值
+    codec_ctx->bit_rate = static_cast<int64_t>(width) * height * config.rate;
+    if (std::string(codec->name) == "libx264") {
+      av_opt_set(codec_ctx->priv_data, "preset", "veryfast", 0);
+      av_opt_set(codec_ctx->priv_data, "crf", "18", 0);
+    }
+    if (format_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+      codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if (avcodec_open2(codec_ctx, codec, nullptr) < 0)
+      vm_log::errore("video_match_corpus: failed to open encoder");
+
+    stream = avformat_new_stream(format_ctx, nullptr);
+    avcodec_parameters_from_context(stream->codecpar, codec_ctx);
+    stream->time_base = codec_ctx->time_base;
+
+    if (avio_open(&format_ctx->pb, file.c_str(), AVIO_FLAG_WRITE) < 0 ||
+        avformat_write_header(format_ctx, nullptr) < 0)
+      vm_log::errore(
+          std::format("video_match_corpus: can not write \"{0}\"", file));
+    packet = av_packet_alloc();
+  }
+
+  ~_encoder() {
+    _encode(nullptr);
+    av_write_trailer(format_ctx);
+    avio_closep(&format_ctx->pb);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_ctx);
+    avformat_free_context(format_ctx);
+  }
+
+  _encoder(const _encoder &) = delete;
+  _encoder &operator=(const _encoder &) = delete;
+
+  void write(AVFrame *frame) {
+    frame->pts = count++;
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    _encode(frame);
+  }
+
+  fnum size() const { return static_cast<fnum>(count); }
+
+private:
+  void _encode(AVFrame *frame) {
+    if (avcodec_send_frame(codec_ctx, frame) < 0)
+      vm_log::errore("video_match_corpus: avcodec_send_frame: error");
+    while (avcodec_receive_packet(codec_ctx, packet) == 0) {
+      av_packet_rescale_ts(packet, codec_ctx->time_base, stream->time_base);
+      packet->stream_index = stream->index;
+      av_interleaved_write_frame(format_ctx, packet);
+    }
+  }
+
+  AVFormatContext *format_ctx = nullptr;
+  AVCodecContext *codec_ctx = nullptr;
+  AVStream *stream = nullptr;
+  AVPacket *packet = nullptr;
+  int64_t count = 0;
+};
+
+// 在 [shift, frames) 中随机选取互不相同的编辑位置
+std::set<fnum> _pick(std::mt19937 &random, const _config &config, int count,
+                     std::set<fnum> &used) {
+  std::set<fnum> result;
+  std::uniform_int_distribution<fnum> position(config.shift + 1,
+                                               config.frames - 1);
+  for (int i = 0; i < count && used.size() < static_cast<size_t>(
+                                                  config.frames - config.shift);
+       ++i) {
+    fnum k;
+    do
+      k = position(random);
+    while (used.contains(k));
+    used.insert(k);
+    result.insert(k);
+  }
+  return result;
+}
+
+// 生成一对视频，返回 video 1 每帧对应的 video 2 帧号，插入的帧为 -1
+std::vector<fnum> _generate(const _config &config, int width, int height) {
+  std::mt19937 random(config.seed);
+  std::set<fnum> used;
+  std::set<fnum> drops = _pick(random, config, config.drop, used);
+  std::set<fnum> dups = _pick(random, config, config.dup, used);
+  std::set<fnum> inserts = _pick(random, config, config.insert, used);
+
+  _source base(_source_graph(config.source, width, height, config.rate));
+  // 插入的帧来自另一个源
+  _source foreign(_source_graph(
+      config.source == "mandelbrot" ? "testsrc2" : "mandelbrot", width, height,
+      config.rate));
+  _encoder video_1(config.output_dir / "video_1.mkv", config, width, height);
+  _encoder video_2(config.output_dir / "video_2.mkv", config, width, height);
+
+  std::vector<fnum> truth;
+  for (fnum k = 0; k < config.frames; ++k) {
+    AVFrame *frame = base.next();
+    video_2.write(frame);
+
+    if (k >= config.shift) {
+      if (inserts.contains(k)) {
+        AVFrame *other = foreign.next();
+        video_1.write(other);
+        av_frame_free(&other);
+        truth.push_back(-1);
+      }
+      if (!drops.contains(k))
+        for (int copy = dups.contains(k) ? 2 : 1; copy; --copy) {
+          video_1.write(frame);
+          truth.push_back(k);
+        }
+    }
+    av_frame_free(&frame);
+  }
+  return truth;
+}
+
+std::vector<fnum> _read_result(const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  std::vector<fnum> result;
+  unsigned char bytes[4];
+  while (file.read(reinterpret_cast<char *>(bytes), sizeof(bytes)))
+    result.push_back(static_cast<fnum>(
+        static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 |
+        static_cast<uint32_t>(bytes[2]) << 16 |
+        static_cast<uint32_t>(bytes[3]) << 24));
+  return result;
+}
+
+void _run(const _config &config, int width, int height) {
+  std::vector<fnum> truth = _generate(config, width, height);
+
+  std::filesystem::path video_1 = config.output_dir / "video_1.mkv",
+                        video_2 = config.output_dir / "video_2.mkv",
+                        result_path = config.output_dir / "result.bin";
+  {
+    std::ofstream truth_file(config.output_dir / "truth.txt");
+    for (size_t i = 0; i < truth.size(); ++i)
+      truth_file << i << "->" << truth[i] << '\n';
+  }
+
+  std::vector<std::string> args{"video_match",
+                                "-i1",
+                                vm_utils::path_to_utf8(video_1),
+                                "-i2",
+                                vm_utils::path_to_utf8(video_2),
+                                "-t",
+                                "binary",
+                                "-log",
+                                vm_utils::path_to_utf8(result_path)};
+  args.insert(args.end(), config.match_args.begin(), config.match_args.end());
+  vm_option::get_option(args);
+
+  auto start = std::chrono::steady_clock::now();
+  vm_match::do_match(vm_option::jobs);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  // 每个 video 2 帧只能被匹配一次，重复帧中只有一帧可以被正确匹配
+  std::vector<fnum> result = _read_result(result_path);
+  std::set<fnum> matchable;
+  size_t matched = 0, correct = 0;
+  for (size_t i = 0; i < truth.size(); ++i) {
+    if (truth[i] != -1)
+      matchable.insert(truth[i]);
+    if (i < result.size() && result[i] != -1) {
+      ++matched;
+      correct += result[i] == truth[i];
+    }
+  }
+
+  std::println(
+      R"({{"source": "{0}", "size": "{1}x{2}", "frames_1": {3}, )"
+      R"("frames_2": {4}, "seconds": {5:.3f}, "fps": {6:.1f}, )"
+      R"("matched": {7}, "correct": {8}, "precision": {9:.5f}, )"
+      R"("recall": {10:.5f}}})",
+      config.source, width, height, truth.size(), config.frames, seconds,
+      truth.size() / std::max(seconds, 1e-9), matched, correct,
+      matched ? static_cast<double>(correct) / matched : 1.0,
+      matchable.empty() ? 1.0
+                        : static_cast<double>(correct) / matchable.size());
+  std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> args(argv, argv + argc);
+  auto separator = std::find(args.begin(), args.end(), "--");
+  _config config;
+  if (separator != args.end())
+    config.match_args.assign(separator + 1, args.end());
+  args.erase(separator, args.end());
+
+  args.push_back("");
+  for (size_t i = 1; i < args.size(); ++i) {
+    if (args[i] == "-o")
+      config.output_dir = vm_utils::utf8_to_path(args[i + 1]);
+    if (args[i] == "-source")
+      config.source = args[i + 1];
+    if (args[i] == "-size") {
+      config.sizes.clear();
+      for (auto size : args[i + 1] | std::views::split(',')) {
+        std::string text(size.begin(), size.end());
+        int width = 0, height = 0;
+        if (std::sscanf(text.c_str(), "%dx%d", &width, &height) != 2 ||
+            width <= 0 || height <= 0)
+          vm_log::errore(std::format("-size {} is invalid", text));
+        config.sizes.emplace_back(width, height);
+      }
+    }
+    if (args[i] == "-rate")
+      config.rate = std::stoi(args[i + 1]);
+    if (args[i] == "-frames")
+      config.frames = std::stoi(args[i + 1]);
+    if (args[i] == "-drop")
+      config.drop = std::stoi(args[i + 1]);
+    if (args[i] == "-dup")
+      config.dup = std::stoi(args[i + 1]);
+    if (args[i] == "-insert")
+      config.insert = std::stoi(args[i + 1]);
+    if (args[i] == "-shift")
+      config.shift = std::stoi(args[i + 1]);
+    if (args[i] == "-seed")
+      config.seed = static_cast<uint32_t>(std::stoul(args[i + 1]));
+    if (args[i] == "-encoder")
+      config.encoder = args[i + 1];
+  }
+
+  if (config.output_dir.empty())
+    vm_log::errore("Need an output directory (-o)");
+  if (config.rate <= 0 || config.frames <= config.shift + 1 ||
+      config.shift < 0)
+    vm_log::errore("-rate, -frames or -shift out of range");
+  std::filesystem::create_directories(config.output_dir);
+
+  for (auto [width, height] : config.sizes)
+    _run(config, width, height);
+}
@@ -1,18 +1,25 @@
+#include "vm_index.hpp"
 #include "vm_log.hpp"
 #include "vm_match.hpp"
 #include "vm_option.hpp"
-#include "vm_output.hpp"
+#include "vm_stats.hpp"
 #include "vm_utils.hpp"
 
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 #include <chrono>
+#include <cstdlib>
+#include <format>
 #include <ranges>
 #include <string>
 
 int main(int argc, char *argv[]) {
 
+#ifdef _WIN32
   SetConsoleCP(CP_UTF8);
   SetConsoleOutputCP(CP_UTF8);
+#endif
 
   // get options
   auto args = std::views::counted(argv, argc) |
@@ -26,20 +33,31 @@ int main(int argc, char *argv[]) {
   vm_option::get_option(args);
 
   // benchmark start
-  std::chrono::steady_clock::time_point start_time;
-  if (vm_option::param::benchmark)
-    start_time = std::chrono::high_resolution_clock::now();
-
-  // match
-  vm_match::do_match();
-
-  // output
-  vm_output::vm_output();
+  std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+
+  int status = EXIT_SUCCESS;
+  if (!vm_option::param::index_path.empty())
+    // index
+    vm_index::build(vm_option::jobs[0], vm_option::param::index_path);
+  else {
+    // match, output as each frame is decided
+    if (!vm_match::do_match(vm_option::jobs))
+      status = EXIT_FAILURE;
+
+    if (!vm_option::param::stats_path.empty())
+      vm_stats::write(vm_option::param::stats_path,
+                      std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start_time)
+                          .count());
+  }
 
   // benchmark end
   if (vm_option::param::benchmark)
     vm_log::info(std::format(
         "benchmark {0}",
         std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::high_resolution_clock::now() - start_time)));
+            std::chrono::steady_clock::now() - start_time)));
+
+  return status;
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "vm_cpu.hpp"
+
+#if VM_X86 && defined(_MSC_VER) && !defined(__clang__)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace vm_cpu {
+
+#if VM_X86 && defined(_MSC_VER) && !defined(__clang__)
+simd_level _detect() {
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+
+  __cpuid(info, 1);
+  bool ssse3 = info[2] & (1 << 9);
+  bool sse41 = info[2] & (1 << 19);
+  bool osxsave = info[2] & (1 << 27);
+  bool avx = info[2] & (1 << 28);
+
+  bool avx2 = false;
+  if (max_leaf >= 7 && osxsave && avx &&
+      (_xgetbv(_XCR_XFEATURE_ENABLED_MASK) & 0x6) == 0x6) {
+    __cpuidex(info, 7, 0);
+    avx2 = info[1] & (1 << 5);
+  }
+
+  if (avx2)
+    return simd_level::avx2;
+  if (sse41)
+    return simd_level::sse41;
+  if (ssse3)
+    return simd_level::ssse3;
+  return simd_level::none;
+}
+#elif VM_X86
+simd_level _detect() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return simd_level::avx2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return simd_level::sse41;
+  if (__builtin_cpu_supports("ssse3"))
+    return simd_level::ssse3;
+  return simd_level::none;
+}
+#else
+simd_level _detect() { return simd_level::none; }
+#endif
+
+simd_level detect() {
+  static const simd_level level = _detect();
+  return level;
+}
+
+} // namespace vm_cpu
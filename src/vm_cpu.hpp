@@ -0,0 +1,23 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VM_X86 1
+#else
+#define VM_X86 0
+#endif
+
+// GCC / Clang 需要按函数开启指令集，MSVC 可直接使用 intrinsics
+#if defined(_MSC_VER) && !defined(__clang__)
+#define VM_TARGET(isa)
+#else
+#define VM_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace vm_cpu {
+
+enum class simd_level { none, ssse3, sse41, avx2 };
+
+// 运行时检测的最高指令集
+simd_level detect();
+
+} // namespace vm_cpu
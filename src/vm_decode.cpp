@@ -0,0 +1,78 @@
+#include "vm_decode.hpp"
+
+#include <utility>
+
+#include "vm_log.hpp"
+
+namespace vm_decode {
+
+decoder::decoder(int num, AVFormatContext *format_ctx,
+                 AVCodecContext *codec_ctx, int stream_index, size_t queue_size,
+                 process_fn process)
+    : demux_stage(num == 1 ? vm_stats::stage::demux_1
+                           : vm_stats::stage::demux_2),
+      decode_stage(num == 1 ? vm_stats::stage::decode_1
+                            : vm_stats::stage::decode_2),
+      format_ctx(format_ctx), codec_ctx(codec_ctx), stream_index(stream_index),
+      process(std::move(process)), queue(queue_size),
+      thread(&decoder::_run, this) {}
+
+decoder::~decoder() {
+  // 消费者提前结束时唤醒阻塞的解码线程
+  queue.close();
+  thread.join();
+  while (vm_frame::frame *frame = pop())
+    delete frame;
+}
+
+vm_frame::frame *decoder::pop() { return queue.pop().value_or(nullptr); }
+
+// 取出解码器中所有可用帧，队列被关闭时返回 false
+bool decoder::_receive(AVFrame *frame) {
+  auto receive = [&] {
+    vm_stats::timer timer(decode_stage);
+    return avcodec_receive_frame(codec_ctx, frame) == 0;
+  };
+  while (receive()) {
+    vm_frame::frame *processed = process(frame);
+    av_frame_unref(frame);
+    if (!queue.push(processed)) {
+      delete processed;
+      return false;
+    }
+  }
+  return true;
+}
+
+void decoder::_run() {
+  AVPacket *packet = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  if (!packet || !frame)
+    vm_log::errore("vm_decode::decoder: alloc error");
+
+  auto read = [&] {
+    vm_stats::timer timer(demux_stage);
+    return av_read_frame(format_ctx, packet) >= 0;
+  };
+  auto send = [&](const AVPacket *packet) {
+    vm_stats::timer timer(decode_stage);
+    return avcodec_send_packet(codec_ctx, packet) == 0;
+  };
+
+  bool is_open = true;
+  while (is_open && read()) {
+    if (packet->stream_index == stream_index && send(packet))
+      is_open = _receive(frame);
+    av_packet_unref(packet);
+  }
+
+  // 发空包，以防缓冲区中仍有帧
+  if (is_open && send(nullptr))
+    _receive(frame);
+
+  queue.close();
+  av_frame_free(&frame);
+  av_packet_free(&packet);
+}
+
+} // namespace vm_decode
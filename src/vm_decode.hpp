@@ -0,0 +1,47 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <functional>
+#include <thread>
+
+#include "vm_frame.hpp"
+#include "vm_queue.hpp"
+#include "vm_stats.hpp"
+
+namespace vm_decode {
+
+// 解码帧转换为比较用帧的函数，在解码线程中调用
+using process_fn = std::function<vm_frame::frame *(AVFrame *)>;
+
+// 独立线程完成 解封装 + 解码 + 预处理，结果放入有界队列
+class decoder {
+public:
+  // num 为视频编号，用于区分统计的阶段
+  decoder(int num, AVFormatContext *format_ctx, AVCodecContext *codec_ctx,
+          int stream_index, size_t queue_size, process_fn process);
+  ~decoder();
+
+  decoder(const decoder &) = delete;
+  decoder &operator=(const decoder &) = delete;
+
+  // 取出下一帧，流结束返回 nullptr，调用者负责释放
+  vm_frame::frame *pop();
+
+private:
+  void _run();
+  bool _receive(AVFrame *frame);
+
+  vm_stats::stage demux_stage, decode_stage;
+  AVFormatContext *format_ctx;
+  AVCodecContext *codec_ctx;
+  int stream_index;
+  process_fn process;
+  vm_queue::spsc_queue<vm_frame::frame *> queue;
+  std::thread thread;
+};
+
+} // namespace vm_decode
@@ -0,0 +1,36 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include "vm_ssim.hpp"
+
+namespace vm_frame {
+
+// 预处理完成的比较用帧，附带解码时一次性算好的信息
+struct frame {
+  AVFrame *gray; // GRAY8, new_width x new_height
+  // -pyramid 粗筛层，GRAY8, coarse_width x coarse_height，未启用时为 nullptr
+  AVFrame *coarse = nullptr;
+  vm_ssim::signature sig;
+  // gray 的内容哈希，用于跳过完全相同帧的 SSIM，-nohash 时不计算，为 0
+  uint64_t hash = 0;
+  int64_t pts = AV_NOPTS_VALUE; // 源帧 best_effort_timestamp
+
+  explicit frame(AVFrame *gray) : gray(gray) {
+    vm_ssim::compute_signature(gray->data[0], gray->linesize[0], gray->width,
+                               gray->height, sig);
+  }
+  // 签名已预先算好，如来自索引文件
+  frame(AVFrame *gray, const vm_ssim::signature &sig) : gray(gray), sig(sig) {}
+  ~frame() {
+    av_frame_free(&gray);
+    av_frame_free(&coarse);
+  }
+
+  frame(const frame &) = delete;
+  frame &operator=(const frame &) = delete;
+};
+
+} // namespace vm_frame
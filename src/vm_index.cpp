@@ -0,0 +1,198 @@
+#include "vm_index.hpp"
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "vm_decode.hpp"
+#include "vm_log.hpp"
+#include "vm_option.hpp"
+#include "vm_scale.hpp"
+#include "vm_utils.hpp"
+
+namespace vm_index {
+
+constexpr uint64_t _align(uint64_t size) { return (size + 63) & ~uint64_t(63); }
+
+bool is_index(const std::string &path) {
+  std::ifstream file(vm_utils::utf8_to_path(path), std::ios::binary);
+  char head[sizeof(magic)] = {};
+  return file.read(head, sizeof(head)) &&
+         std::memcmp(head, magic, sizeof(magic)) == 0;
+}
+
+void build(const vm_option::job &job, const std::string &path) {
+  const vm_option::video_2 &video = job.videos_2[0];
+  AVStream *stream = video.formatContext->streams[video.video_stream_index];
+  std::filesystem::path source = vm_utils::utf8_to_path(video.input_video_path);
+
+  header head{};
+  std::memcpy(head.magic, magic, sizeof(magic));
+  head.version = version;
+  head.signature_size = sizeof(vm_ssim::signature);
+
+  std::error_code ec;
+  std::string source_path =
+      vm_utils::path_to_utf8(std::filesystem::absolute(source, ec));
+  std::strncpy(head.source_path, source_path.c_str(),
+               sizeof(head.source_path) - 1);
+  head.source_size = std::filesystem::file_size(source, ec);
+  head.source_mtime =
+      std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+
+  head.source_width = stream->codecpar->width;
+  head.source_height = stream->codecpar->height;
+  head.frame_rate_num = stream->avg_frame_rate.num;
+  head.frame_rate_den = stream->avg_frame_rate.den;
+
+  head.decode_speed = static_cast<int32_t>(job.decode_speed);
+  head.lowres = video.codecContext->lowres;
+
+  head.frame_scale = job.frame_scale;
+  head.width = job.new_width;
+  head.height = job.new_height;
+  head.linesize = static_cast<int32_t>(_align(head.width));
+  head.record_size = _align(sizeof(vm_ssim::signature)) +
+                     static_cast<uint64_t>(head.linesize) * head.height;
+  head.data_offset = _align(sizeof(header));
+
+  std::ofstream file(vm_utils::utf8_to_path(path), std::ios::binary);
+  if (!file.is_open())
+    vm_log::errore("Unable to open index file \"" + path + "\"");
+
+  std::vector<char> record(head.data_offset, 0);
+  std::memcpy(record.data(), &head, sizeof(head));
+  file.write(record.data(), record.size());
+
+  vm_decode::decoder decoder(
+      2, video.formatContext, video.codecContext, video.video_stream_index, 8,
+      [&job](AVFrame *frame) {
+        return new vm_frame::frame(
+            vm_scale::to_gray(frame, job.new_width, job.new_height));
+      });
+
+  record.assign(head.record_size, 0);
+  char *pixels = record.data() + _align(sizeof(vm_ssim::signature));
+  while (vm_frame::frame *frame = decoder.pop()) {
+    std::memcpy(record.data(), &frame->sig, sizeof(frame->sig));
+    for (int y = 0; y < head.height; ++y)
+      std::memcpy(pixels + static_cast<ptrdiff_t>(y) * head.linesize,
+                  frame->gray->data[0] +
+                      static_cast<ptrdiff_t>(y) * frame->gray->linesize[0],
+                  head.width);
+    file.write(record.data(), record.size());
+    ++head.frame_count;
+    delete frame;
+  }
+
+  // 回填帧数
+  file.seekp(0);
+  file.write(reinterpret_cast<const char *>(&head), sizeof(head));
+  file.close();
+  if (!file)
+    vm_log::errore("Failed to write index file \"" + path + "\"");
+
+  vm_log::info(std::format("Index \"{0}\": {1} F, {2}x{3}", path,
+                           head.frame_count, head.width, head.height));
+}
+
+reader::reader(const std::string &path) {
+#ifdef _WIN32
+  std::filesystem::path file_path = vm_utils::utf8_to_path(path);
+  file = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    vm_log::errore("Unable to open index file \"" + path + "\"");
+
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file, &file_size);
+  data_size = file_size.QuadPart;
+
+  mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping)
+    data = static_cast<const uint8_t *>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+  file = open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    vm_log::errore("Unable to open index file \"" + path + "\"");
+
+  struct stat file_stat;
+  fstat(file, &file_stat);
+  data_size = file_stat.st_size;
+
+  void *map = mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, file, 0);
+  if (map != MAP_FAILED) {
+    data = static_cast<const uint8_t *>(map);
+    madvise(map, data_size, MADV_SEQUENTIAL);
+  }
+#endif
+  if (!data)
+    vm_log::errore("Unable to map index file \"" + path + "\"");
+
+  // 校验
+  head = reinterpret_cast<const header *>(data);
+  if (data_size < sizeof(header) ||
+      std::memcmp(head->magic, magic, sizeof(magic)) != 0)
+    vm_log::errore("\"" + path + "\" is not an index file");
+  if (head->version != version ||
+      head->signature_size != sizeof(vm_ssim::signature))
+    vm_log::errore(std::format(
+        "Index \"{0}\" version {1} is not supported, rebuild it with -mkindex",
+        path, head->version));
+  if (head->data_offset + head->record_size * head->frame_count > data_size)
+    vm_log::errore("Index \"" + path + "\" is truncated");
+}
+
+reader::~reader() {
+#ifdef _WIN32
+  if (data)
+    UnmapViewOfFile(data);
+  if (mapping)
+    CloseHandle(mapping);
+  if (file && file != INVALID_HANDLE_VALUE)
+    CloseHandle(file);
+#else
+  if (data)
+    munmap(const_cast<uint8_t *>(data), data_size);
+  if (file >= 0)
+    close(file);
+#endif
+}
+
+vm_frame::frame *reader::get(fnum n) const {
+  const uint8_t *record =
+      data + head->data_offset + static_cast<uint64_t>(n) * head->record_size;
+
+  vm_ssim::signature sig;
+  std::memcpy(&sig, record, sizeof(sig));
+
+  AVFrame *gray = av_frame_alloc();
+  if (!gray)
+    vm_log::errore("vm_index::reader::get: av_frame_alloc: error");
+  gray->width = head->width;
+  gray->height = head->height;
+  gray->format = AV_PIX_FMT_GRAY8;
+  // 不带引用计数，av_frame_free 不会释放映射内存
+  gray->data[0] =
+      const_cast<uint8_t *>(record + _align(sizeof(vm_ssim::signature)));
+  gray->linesize[0] = head->linesize;
+
+  return new vm_frame::frame(gray, sig);
+}
+
+} // namespace vm_index
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "vm_frame.hpp"
+#include "vm_option.hpp"
+#include "vm_type.hpp"
+
+namespace vm_index {
+
+// 索引文件: 文件头 + 每帧一条记录 {签名, 缩放后的亮度平面}
+// 记录按 64 字节对齐，可直接内存映射使用
+constexpr char magic[8] = {'V', 'M', 'I', 'D', 'X', 0, 0, 0};
+// 预处理或记录格式改变时递增
+constexpr uint32_t version = 3;
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t signature_size;
+
+  // 源文件标识
+  char source_path[1024];
+  uint64_t source_size;
+  int64_t source_mtime;
+
+  // 源视频参数
+  int32_t source_width, source_height;
+  int32_t frame_rate_num, frame_rate_den;
+
+  // 预处理参数
+  double frame_scale;
+  int32_t width, height, linesize;
+  // 解码参数，-decode-speed 与实际使用的 lowres
+  int32_t decode_speed, lowres;
+
+  int32_t frame_count;
+  uint64_t record_size;
+  uint64_t data_offset;
+};
+
+// 文件是否为索引
+bool is_index(const std::string &path);
+
+// 解码 job 的第一个 video 2 并写出索引
+void build(const vm_option::job &job, const std::string &path);
+
+// 以只读内存映射打开索引，帧数据按需换页，不解码
+class reader {
+public:
+  explicit reader(const std::string &path);
+  ~reader();
+
+  reader(const reader &) = delete;
+  reader &operator=(const reader &) = delete;
+
+  const header &info() const { return *head; }
+  fnum size() const { return head->frame_count; }
+
+  // 第 n 帧，像素直接指向映射内存
+  vm_frame::frame *get(fnum n) const;
+
+private:
+  const uint8_t *data = nullptr;
+  uint64_t data_size = 0;
+  const header *head = nullptr;
+#ifdef _WIN32
+  void *file = nullptr, *mapping = nullptr;
+#else
+  int file = -1;
+#endif
+};
+
+} // namespace vm_index
@@ -1,20 +1,33 @@
 #include "vm_log.hpp"
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <unistd.h>
+#endif
 #include <cstdlib>
 #include <format>
 #include <print>
+#include <string>
 
 #include "vm_version.hpp"
 
 namespace vm_log {
 
+// 当前线程是否处于 job_scope 中
+thread_local bool _in_job = false;
+
 void output(const std::string_view &msg) { std::println("{}", msg); }
 
 void change_title(const std::string_view &msg) {
   std::string output = std::format("{0} {1} v{2}", msg, PROGRAM_NAME, VERSION);
-  // std::cout << "\033]0;" << output << "\007";
+#ifdef _WIN32
   SetConsoleTitle(output.c_str());
+#else
+  // 只在终端中设置标题，避免污染重定向的输出
+  if (isatty(STDERR_FILENO))
+    std::print(stderr, "\033]0;{}\007", output);
+#endif
 }
 
 void error(const std::string_view &msg) {
@@ -23,9 +36,15 @@ void error(const std::string_view &msg) {
 
 void errore(const std::string_view &msg) {
   error(msg);
+  if (_in_job)
+    throw job_error(std::string(msg));
   std::exit(EXIT_SUCCESS);
 }
 
+job_scope::job_scope() : previous(_in_job) { _in_job = true; }
+
+job_scope::~job_scope() { _in_job = previous; }
+
 void warning(const std::string_view &msg) {
   std::println(stderr, "\033[33m[{} WARNING]\033[0m {}", PROGRAM_NAME, msg);
 }
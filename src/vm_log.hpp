@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdexcept>
 #include <string_view>
 
 namespace vm_log {
@@ -10,8 +11,27 @@ void change_title(const std::string_view &info);
 
 void error(const std::string_view &info);
 
+// 输出错误并退出，存在 job_scope 时改为抛出 job_error
 void errore(const std::string_view &info);
 
+// -jobs 中单个 job 出错时由 errore 抛出，what() 为错误信息
+struct job_error : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// 存在期间当前线程的 errore 抛出 job_error，使出错的 job 不影响其他 job
+class job_scope {
+public:
+  job_scope();
+  ~job_scope();
+
+  job_scope(const job_scope &) = delete;
+  job_scope &operator=(const job_scope &) = delete;
+
+private:
+  bool previous;
+};
+
 void warning(const std::string_view &info);
 
 void info(const std::string_view &info);
@@ -5,163 +5,467 @@ extern "C" {
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavutil/buffer.h>
-#include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
 }
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <format>
-#include <map>
+#include <limits>
+#include <mutex>
+#include <memory>
+#include <numeric>
+#include <span>
 #include <thread>
+#include <vector>
 
+#include "vm_decode.hpp"
+#include "vm_frame.hpp"
+#include "vm_index.hpp"
 #include "vm_log.hpp"
 #include "vm_option.hpp"
+#include "vm_output.hpp"
+#include "vm_pool.hpp"
+#include "vm_progress.hpp"
+#include "vm_scale.hpp"
+#include "vm_segment.hpp"
+#include "vm_ssim.hpp"
+#include "vm_stats.hpp"
+#include "vm_window.hpp"
 
 namespace vm_match {
 
-class AV_map : public std::map<fnum, AVFrame *> {
-  using std::map<fnum, AVFrame *>::map;
+AVFilterGraph *ssim_graph;
+vm_pool::pool *pool;
+// 只有一个 job 时的进度，-jobs 时为 nullptr
+vm_progress::reporter *progress;
+// -ssim check 时两种实现允许的误差
+constexpr double ssim_check_tolerance = 1e-4;
+// 预筛选上界的浮点误差余量
+constexpr double prefilter_margin = 1e-4;
+// video 1 解码队列长度，video 2 按 frame_forward 预读
+constexpr size_t decode_queue_size_1 = 8;
+// 自适应窗口连续这么多帧未匹配时变大
+constexpr int forward_grow_misses = 2;
+// 与前一帧的签名上界低于此值时视为镜头切换
+constexpr double scene_cut_bound = 0.8;
+// -resync 每次最多用 SSIM 验证这么多个跳转目标
+constexpr size_t resync_candidates = 8;
 
-public:
-  void clear() {
-    for (std::pair<const fnum, AVFrame *> &pair : *this)
-      av_frame_free(&pair.second);
-    std::map<fnum, AVFrame *>::clear();
+// 窗口跨度最多为 [frame_num_1 - 1 - forward, frame_num_1 + 2 * forward)
+// 自适应时 forward 不超过 forward_max
+size_t _window_capacity(const vm_option::job &job) {
+  return 3 * static_cast<size_t>(job.forward_max) + 1;
+}
+
+// 用完的窗口，尺寸相同的 job 可直接复用，避免重新分配与缺页
+std::mutex window_cache_mutex;
+std::vector<vm_window::window *> window_cache;
+
+vm_window::window *_new_window(const vm_option::job &job) {
+  size_t capacity = _window_capacity(job);
+  {
+    std::lock_guard lock(window_cache_mutex);
+    auto it = std::find_if(
+        window_cache.begin(), window_cache.end(), [&](vm_window::window *w) {
+          return w->same_layout(capacity, job.new_width, job.new_height,
+                                job.coarse_width, job.coarse_height);
+        });
+    if (it != window_cache.end()) {
+      vm_window::window *result = *it;
+      window_cache.erase(it);
+      result->clear();
+      return result;
+    }
   }
+  return new vm_window::window(capacity, job.new_width, job.new_height,
+                               job.coarse_width, job.coarse_height);
+}
 
-  void erase(std::map<fnum, AVFrame *>::iterator it) {
-    av_frame_free(&it->second);
-    std::map<fnum, AVFrame *>::erase(it);
+// 最多保留 -concurrency 个，超出时释放最早放入的
+void _release_window(vm_window::window *window) {
+  if (!window)
+    return;
+  std::lock_guard lock(window_cache_mutex);
+  window_cache.push_back(window);
+  if (window_cache.size() >
+      static_cast<size_t>(vm_option::param::concurrency)) {
+    delete window_cache.front();
+    window_cache.erase(window_cache.begin());
   }
+}
+
+void _clear_window_cache() {
+  for (vm_window::window *window : window_cache)
+    delete window;
+  window_cache.clear();
+}
+
+// 某一帧开始匹配前的状态，相同状态之后的匹配结果相同
+// 分段之间据此判断衔接处是否与单次匹配一致
+struct _boundary {
+  fnum window_begin = 0, window_end = 0, read_pos = 0;
+  fnum last_match_1 = -1, last_match_2 = -1;
+  bool can_not_flush_buffer = false;
+  std::vector<fnum> consumed; // 窗口内已匹配的 video 2 帧
+  int forward = 0, misses = 0, steady = 0;
+  fnum offset = 0;
+
+  bool operator==(const _boundary &) const = default;
+};
+
+// 一个 video 2 的一次顺序匹配的状态，分段并行时每段一份
+// 多个 video 2 时各有一份，共用第一份的 decoder_1
+struct _run {
+  const vm_option::job *job = nullptr;
+  const vm_option::video_2 *video_2 = nullptr;
+  // 结果按帧号顺序追加到 match_list，为 nullptr 时写到 output
+  std::vector<fnum> *match_list = nullptr;
+  vm_output::output *output = nullptr;
+  // 从此帧开始计入进度并记录 entry
+  fnum output_begin = 0;
+  _boundary entry;
+  // video 1 的帧数只由第一份计入
+  bool count_frames_1 = true;
+
+  vm_window::window *frame_buffer = nullptr;
+  vm_decode::decoder *decoder_1 = nullptr, *decoder_2 = nullptr;
+  // decoder_2 使用的上下文，分段时为该段使用的一份，_seek_2 定位这一份
+  AVFormatContext *format_ctx_2 = nullptr;
+  AVCodecContext *codec_ctx_2 = nullptr;
+  int stream_index_2 = -1;
+  // 分段时按 PTS 换算帧号，为 nullptr 时按解码顺序计数
+  const vm_segment::timeline *timeline_1 = nullptr, *timeline_2 = nullptr;
+  // decoder_2 已取出但还未放入窗口的帧
+  vm_frame::frame *pending_2 = nullptr;
+  fnum pending_num_2 = -1, decoded_2 = 0;
 
-  void erase(fnum key) {
-    auto it = this->find(key);
-    if (it != this->end())
-      erase(it);
+  fnum buffer_read_pos = 0;
+  fnum video_frame_num_1 = 0;
+  // 最近一次匹配的帧号，用于预测下一帧的位置
+  fnum last_match_1 = -1, last_match_2 = -1;
+  bool can_not_flush_buffer = false;
+  // 当前的 -forward，连续未匹配与以不变偏移连续匹配的帧数
+  int forward = 0, misses = 0, steady = 0;
+  // 窗口围绕 video 2 的帧 video_frame_num_1 + offset，-resync 跳转后改变
+  fnum offset = 0;
+
+  // -packet: 已按包对齐的 video 2 帧，读入窗口时即标记已匹配
+  const std::vector<uint8_t> *claimed_2 = nullptr;
+
+  // -resync: 0 为关闭，video 1 连续未匹配的帧数
+  int resync = 0;
+  fnum miss_streak = 0;
+  // video 2 的镜头切换索引，覆盖帧号 [0, indexed_2)
+  std::vector<std::pair<fnum, vm_ssim::signature>> cuts_2;
+  fnum indexed_2 = 0;
+  vm_ssim::signature last_sig_2;
+
+  // 当前帧的候选，按探测顺序排列
+  std::vector<std::pair<fnum, vm_frame::frame *>> candidates;
+  std::vector<double> score;
+  std::vector<size_t> rank;
+  std::vector<uint8_t> verified;
+
+  // 已计入 vm_stats 的窗口占用
+  int64_t window_frames = 0, window_bytes = 0;
+
+  ~_run() {
+    vm_stats::window_fill(-window_frames, -window_bytes);
+    delete decoder_1;
+    delete decoder_2;
+    delete pending_2;
+    _release_window(frame_buffer);
   }
 };
 
-fnum *match_frame_list;
-AV_map frame_buffer_map;
-fnum frame_buffer_back, buffer_read_pos;
-fnum video_frame_num_1;
-AVFilterGraph *ssim_graph = avfilter_graph_alloc();
-bool can_not_flush_buffer;
-
-// 自动转换pix_fmt并缩放
-AVFrame *_auto_pix_fmt_process(AVFrame *&frame) {
-
-  AVFrame *new_frame = av_frame_alloc();
-
-  new_frame->width = vm_option::new_width;
-  new_frame->height = vm_option::new_height;
-  new_frame->format = AV_PIX_FMT_GRAY8;
-
-  // 为输出帧分配缓冲区
-  if (av_image_alloc(new_frame->data, new_frame->linesize, vm_option::new_width,
-                     vm_option::new_height, AVPixelFormat::AV_PIX_FMT_GRAY8,
-                     32) < 0) {
-    av_frame_free(&new_frame);
-    vm_log::errore("vm_match::_auto_pix_fmt_process: av_image_alloc: error");
-  }
-
-  SwsContext *sws_ctx = sws_getContext(
-      frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
-      vm_option::new_width, vm_option::new_height,
-      AVPixelFormat::AV_PIX_FMT_GRAY8, SWS_POINT, NULL, NULL, NULL);
-  if (!sws_ctx) {
-    av_frame_free(&new_frame);
-    vm_log::errore("vm_match::_auto_pix_fmt_process: sws_getContext: error");
-  }
-
-  // 执行转换
-  sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height,
-            new_frame->data, new_frame->linesize);
-
-  sws_freeContext(sws_ctx);
-  return new_frame;
-}
-
-// 读取 video 2 的下一帧
-int8_t _read_frame_2(fnum frame_num) {
-  // 读取
-  frame_buffer_map[frame_num] = av_frame_alloc();
-  bool isread = false;
-  AVPacket packet;
-  while (av_read_frame(vm_option::formatContext_2, &packet) >= 0) {
-    if (packet.stream_index == vm_option::video_stream_index_2)
-      if (avcodec_send_packet(vm_option::codecContext_2, &packet) == 0)
-        while (avcodec_receive_frame(vm_option::codecContext_2,
-                                     frame_buffer_map[frame_num]) == 0) {
-          isread = true;
-          break;
-        }
-    av_packet_unref(&packet);
-    if (isread)
-      break;
+// 记录 run.video_frame_num_1 的结果并前进一帧
+void _set_result(_run &run, fnum frame_2) {
+  if (run.match_list)
+    run.match_list->push_back(frame_2);
+  else
+    run.output->write(run.video_frame_num_1, frame_2);
+
+  if (run.video_frame_num_1 >= run.output_begin) {
+    if (run.count_frames_1)
+      vm_stats::add(vm_stats::counter::frames_1);
+    if (frame_2 != -1)
+      vm_stats::add(vm_stats::counter::matched);
   }
+  ++run.video_frame_num_1;
+}
 
-  // 包读完了读缓存，防止缓存剩帧没读
-  if (!isread)
-    if (avcodec_send_packet(vm_option::codecContext_2, nullptr) == 0) {
-      // 强制写入所有帧到buffer
-      while (avcodec_receive_frame(vm_option::codecContext_2,
-                                   frame_buffer_map[frame_num]) >= 0) {
-        isread = true;
-        if (++frame_num < vm_option::frame_count_2)
-          frame_buffer_map[frame_num] = av_frame_alloc();
-        else {
-          can_not_flush_buffer = true;
-          return -1;
-        }
-      }
+// 计算 frame 的内容哈希，-nohash 时跳过
+void _hash(const vm_option::job &job, vm_frame::frame &frame) {
+  if (job.hash)
+    frame.hash = vm_ssim::hash(frame.gray->data[0], frame.gray->linesize[0],
+                               frame.gray->width, frame.gray->height);
+}
+
+// 自动转换pix_fmt并缩放，同时计算预筛选签名与内容哈希
+vm_frame::frame *_auto_pix_fmt_process(const vm_option::job &job,
+                                       AVFrame *frame) {
+  vm_stats::timer timer(vm_stats::stage::scale);
+  vm_frame::frame *result = new vm_frame::frame(
+      vm_scale::to_gray(frame, job.new_width, job.new_height));
+  _hash(job, *result);
+  result->pts = frame->best_effort_timestamp;
+  if (job.pyramid)
+    result->coarse =
+        vm_scale::downscale(result->gray, vm_option::pyramid_factor);
+  return result;
+}
+
+// 解码线程中调用的预处理，job 须在解码器结束前保持有效
+vm_decode::process_fn _process(const vm_option::job &job) {
+  return [&job](AVFrame *frame) { return _auto_pix_fmt_process(job, frame); };
+}
+
+// -resync: 按帧号顺序把 video 2 的镜头切换加入索引，已索引的帧跳过
+void _index_cut(_run &run, fnum frame_num, const vm_ssim::signature &sig) {
+  if (!run.resync || frame_num < run.indexed_2)
+    return;
+  if (!frame_num ||
+      vm_ssim::upper_bound(run.last_sig_2, sig) < scene_cut_bound)
+    run.cuts_2.emplace_back(frame_num, sig);
+  run.last_sig_2 = sig;
+  run.indexed_2 = frame_num + 1;
+}
+
+// 从 decoder_2 取下一帧作为 pending_2，流结束时返回 false
+bool _pop_2(_run &run) {
+  delete run.pending_2;
+  run.pending_2 = run.decoder_2->pop();
+  if (!run.pending_2)
+    return false;
+  run.pending_num_2 = run.timeline_2
+                          ? run.timeline_2->index(run.pending_2->pts)
+                          : run.decoded_2++;
+  _index_cut(run, run.pending_num_2, run.pending_2->sig);
+  return true;
+}
+
+// 从解码线程或索引取 video 2 的帧 frame_num，拷入窗口后释放
+int8_t _read_frame_2(_run &run, fnum frame_num) {
+  const vm_option::video_2 &video = *run.video_2;
+  vm_frame::frame *frame = nullptr;
+  bool missing = false;
+  if (video.index) {
+    if (frame_num < video.index->size()) {
+      frame = video.index->get(frame_num);
+      // 索引中不保存哈希
+      _hash(*run.job, *frame);
+      _index_cut(run, frame_num, frame->sig);
     }
+  } else {
+    // 跳过定位点之前的帧
+    while ((!run.pending_2 || run.pending_num_2 < frame_num) && _pop_2(run))
+      ;
 
-  if (!isread) {
-    frame_buffer_map.erase(frame_num);
-    vm_log::error("vm_match::_read_frame_2: Failed to read frame in video 2");
-    return 1;
+    frame = run.pending_2;
+    if (run.pending_num_2 == frame_num)
+      run.pending_2 = nullptr;
+    else
+      // 无法解码的帧用下一帧占位，并且不参与匹配
+      missing = true;
   }
 
+  if (!frame) {
+    run.can_not_flush_buffer = true;
+    return -1;
+  }
+
+  run.frame_buffer->push(frame_num, *frame);
+  vm_stats::add(vm_stats::counter::frames_2);
+  if (missing)
+    run.frame_buffer->consume(frame_num);
+  else
+    delete frame;
+  if (run.claimed_2 && (*run.claimed_2)[frame_num])
+    run.frame_buffer->consume(frame_num);
   return 0;
 }
 
-void _flush_buffer() {
-  if (can_not_flush_buffer)
+// 在 run 的上下文上创建 decoder_2
+void _new_decoder_2(_run &run) {
+  run.decoder_2 = new vm_decode::decoder(
+      2, run.format_ctx_2, run.codec_ctx_2, run.stream_index_2,
+      run.job->frame_forward, _process(*run.job));
+}
+
+// 重新定位 decoder_2，之后从 frame_num 之前最近的关键帧开始取帧
+// 返回 false 时无法定位，decoder_2 从原来的位置继续，只能取到之后的帧
+bool _seek_2(_run &run, fnum frame_num) {
+  delete run.decoder_2;
+  delete run.pending_2;
+  run.pending_2 = nullptr;
+  run.pending_num_2 = -1;
+  bool result =
+      vm_segment::seek(run.format_ctx_2, run.codec_ctx_2, run.stream_index_2,
+                       *run.timeline_2, frame_num);
+  _new_decoder_2(run);
+  return result;
+}
+
+// 更新 vm_stats 中的窗口占用
+void _report_window(_run &run) {
+  int64_t frames = run.frame_buffer->end() - run.frame_buffer->begin();
+  int64_t bytes =
+      frames * static_cast<int64_t>(run.frame_buffer->frame_bytes());
+  vm_stats::window_fill(frames - run.window_frames, bytes - run.window_bytes);
+  run.window_frames = frames;
+  run.window_bytes = bytes;
+}
+
+// -pts: 按时间戳预测 video 1 当前帧在 video 2 中的帧号，保持上次匹配的时间差
+fnum _predict_pts(const _run &run) {
+  const vm_segment::timeline &line_1 = run.job->timeline_1,
+                             &line_2 = run.video_2->timeline;
+  double delta = run.last_match_2 >= 0
+                     ? line_2.time(run.last_match_2) -
+                           line_1.time(run.last_match_1)
+                     : 0;
+  return line_2.at(line_1.time(run.video_frame_num_1) + delta);
+}
+
+// -pts: 窗口跟随预测位置，预测每帧可能移动多于一帧
+// 先移除旧帧再读入，每次读入不超过窗口的剩余容量
+// 预测的窗口起点超出已读取的位置时跳过中间的帧，超出一个窗口容量以上时直接定位
+void _flush_pts(_run &run) {
+  vm_window::window &frame_buffer = *run.frame_buffer;
+  fnum frame_count_2 = run.video_2->frame_count;
+  fnum capacity = static_cast<fnum>(frame_buffer.capacity());
+  run.offset = _predict_pts(run) - run.video_frame_num_1;
+  fnum frame_num_2 = run.video_frame_num_1 + run.offset;
+  fnum begin = std::min(frame_count_2, frame_num_2 - run.forward);
+
+  frame_buffer.retire_before(begin);
+  if (begin > run.buffer_read_pos) {
+    if (!run.video_2->index && begin > run.buffer_read_pos + capacity)
+      _seek_2(run, begin);
+    // 窗口已空，_read_frame_2 丢弃解码出的 begin 之前的帧
+    run.buffer_read_pos = begin;
+  }
+
+  while (frame_num_2 + run.forward >= run.buffer_read_pos &&
+         run.buffer_read_pos < frame_count_2) {
+    fnum room = capacity - (frame_buffer.end() - frame_buffer.begin());
+    fnum end = std::min({run.buffer_read_pos + run.forward,
+                         run.buffer_read_pos + room, frame_count_2});
+    if (end <= run.buffer_read_pos)
+      break;
+    for (; run.buffer_read_pos < end; ++run.buffer_read_pos)
+      if (_read_frame_2(run, run.buffer_read_pos) == -1) {
+        run.buffer_read_pos = frame_count_2;
+        break;
+      }
+  }
+  _report_window(run);
+}
+
+void _flush_buffer(_run &run) {
+  if (run.can_not_flush_buffer)
     return;
+  vm_stats::timer timer(vm_stats::stage::window);
+  if (run.job->pts) {
+    _flush_pts(run);
+    return;
+  }
+  fnum frame_count_2 = run.video_2->frame_count;
+
+  fnum frame_num_2 = run.video_frame_num_1 + run.offset;
   // 读取新一段buffer
-  if (video_frame_num_1 + vm_option::param::frame_forward >= buffer_read_pos) {
-    for (fnum i = buffer_read_pos;
-         i < buffer_read_pos + vm_option::param::frame_forward &&
-         i < vm_option::frame_count_2;
-         ++i) {
-      switch (_read_frame_2(i)) {
+  if (frame_num_2 + run.forward >= run.buffer_read_pos) {
+    for (fnum i = run.buffer_read_pos;
+         i < run.buffer_read_pos + run.forward && i < frame_count_2; ++i) {
+      switch (_read_frame_2(run, i)) {
       case 1:
         vm_log::error(std::format(
             "vm_match::_flush_buffer: Get frame_2 error in frame {0}", i));
         break;
       case -1:
-        buffer_read_pos = vm_option::frame_count_2;
+        run.buffer_read_pos = frame_count_2;
+        _report_window(run);
         return;
       }
     }
 
-    buffer_read_pos += vm_option::param::frame_forward;
+    run.buffer_read_pos += run.forward;
+    // 窗口在移除旧帧之前最大
+    _report_window(run);
   }
 
   // 移除超出的旧帧
-  for (auto it = frame_buffer_map.begin(); it != frame_buffer_map.end(); ++it) {
-    if (it->first <
-        std::min(vm_option::frame_count_2,
-                 video_frame_num_1 -
-                     static_cast<fnum>(vm_option::param::frame_forward)))
-      frame_buffer_map.erase(it);
-    else
+  run.frame_buffer->retire_before(
+      std::min(frame_count_2, frame_num_2 - run.forward));
+}
+
+// 单次匹配中 frame_num 开始匹配前的状态，只取决于帧号
+// 用于从中间开始的匹配，此时窗口内还没有已匹配的帧
+// 假定窗口大小固定且不按时间戳预测，其余情况 _check_job 不分段
+_boundary _initial_boundary(const vm_option::job &job,
+                            const vm_option::video_2 &video, fnum frame_num) {
+  _boundary result;
+  for (fnum i = 0; i < frame_num; ++i)
+    if (i + job.frame_forward >= result.read_pos)
+      result.read_pos += job.frame_forward;
+  result.window_begin =
+      std::clamp(frame_num - 1 - static_cast<fnum>(job.frame_forward), 0,
+                 video.frame_count);
+  result.window_end = result.read_pos;
+  result.forward = job.frame_forward;
+  return result;
+}
+
+// 按边界状态填充窗口，之后与单次匹配在该帧处的状态相同
+void _restore(_run &run, const _boundary &state) {
+  vm_stats::timer timer(vm_stats::stage::window);
+  fnum frame_count_2 = run.video_2->frame_count;
+  run.buffer_read_pos = state.read_pos;
+  run.last_match_1 = state.last_match_1;
+  run.last_match_2 = state.last_match_2;
+  run.forward = state.forward;
+  run.misses = state.misses;
+  run.steady = state.steady;
+  run.offset = state.offset;
+  for (fnum i = state.window_begin; i < state.window_end && i < frame_count_2;
+       ++i)
+    if (_read_frame_2(run, i) == -1) {
+      run.buffer_read_pos = frame_count_2;
       break;
-  }
+    }
+  run.frame_buffer->retire_before(state.window_begin);
+  run.can_not_flush_buffer |= state.can_not_flush_buffer;
+  for (fnum i : state.consumed)
+    run.frame_buffer->consume(i);
+  _report_window(run);
+}
+
+_boundary _capture(_run &run) {
+  _boundary result;
+  result.window_begin = run.frame_buffer->begin();
+  result.window_end = run.frame_buffer->end();
+  // 空窗口的起点没有意义
+  if (result.window_begin == result.window_end)
+    result.window_begin = result.window_end = 0;
+  result.read_pos = run.buffer_read_pos;
+  result.last_match_1 = run.last_match_1;
+  result.last_match_2 = run.last_match_2;
+  result.can_not_flush_buffer = run.can_not_flush_buffer;
+  result.forward = run.forward;
+  result.misses = run.misses;
+  result.steady = run.steady;
+  result.offset = run.offset;
+  for (fnum i = run.frame_buffer->begin(); i < run.frame_buffer->end(); ++i)
+    if (!run.frame_buffer->find(i))
+      result.consumed.push_back(i);
+  return result;
 }
 
 // 初始化滤镜图并配置SSIM滤镜
-void init_ssim_filter_graph() {
+void init_ssim_filter_graph(const vm_option::job &job) {
+  ssim_graph = avfilter_graph_alloc();
   if (!ssim_graph)
     vm_log::errore("Failed to create filter graph");
 
@@ -169,8 +473,8 @@ void init_ssim_filter_graph() {
   AVFilterContext *buffersrc_ctx_main = nullptr;
   char args_main[512];
   snprintf(args_main, sizeof(args_main),
-           "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d", vm_option::new_width,
-           vm_option::new_height, AV_PIX_FMT_GRAY8, 1, 24);
+           "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d", job.new_width,
+           job.new_height, AV_PIX_FMT_GRAY8, 1, 24);
   const AVFilter *buffersrc = avfilter_get_by_name("buffer");
   if (avfilter_graph_create_filter(&buffersrc_ctx_main, buffersrc, "src_main",
                                    args_main, nullptr, ssim_graph) < 0)
@@ -180,8 +484,8 @@ void init_ssim_filter_graph() {
   AVFilterContext *buffersrc_ctx_ref = nullptr;
   char args_ref[512];
   snprintf(args_ref, sizeof(args_ref),
-           "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d", vm_option::new_width,
-           vm_option::new_height, AV_PIX_FMT_GRAY8, 1, 24);
+           "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d", job.new_width,
+           job.new_height, AV_PIX_FMT_GRAY8, 1, 24);
   if (avfilter_graph_create_filter(&buffersrc_ctx_ref, buffersrc, "src_ref",
                                    args_ref, nullptr, ssim_graph) < 0)
     vm_log::errore("Failed to create buffer source for reference");
@@ -211,7 +515,8 @@ void init_ssim_filter_graph() {
     vm_log::errore("Failed to configure filter graph");
 }
 
-double compare_ssim(AVFrame *frame_1, AVFrame *frame_2) {
+// 滤镜图实现，作为原生实现的参考
+double compare_ssim_lavfi(AVFrame *frame_1, AVFrame *frame_2) {
   if (!frame_1) {
     vm_log::error("vm_match::compare_ssim: frame_1 is nullptr");
     return -1;
@@ -229,11 +534,13 @@ double compare_ssim(AVFrame *frame_1, AVFrame *frame_2) {
   AVFilterContext *buffersink_ctx =
       avfilter_graph_get_filter(ssim_graph, "sink");
 
-  // 将帧发送到滤镜图的输入端
+  // 将帧发送到滤镜图的输入端，保留原帧供窗口内其他对比复用
   av_buffersrc_add_frame_flags(buffersrc_ctx_main, frame_1,
-                               AV_BUFFERSRC_FLAG_PUSH);
+                               AV_BUFFERSRC_FLAG_PUSH |
+                                   AV_BUFFERSRC_FLAG_KEEP_REF);
   av_buffersrc_add_frame_flags(buffersrc_ctx_ref, frame_2,
-                               AV_BUFFERSRC_FLAG_PUSH);
+                               AV_BUFFERSRC_FLAG_PUSH |
+                                   AV_BUFFERSRC_FLAG_KEEP_REF);
 
   // 从滤镜图的输出端获取 SSIM 值
   AVFrame *frame_out = av_frame_alloc();
@@ -258,113 +565,845 @@ double compare_ssim(AVFrame *frame_1, AVFrame *frame_2) {
 
   av_frame_free(&frame_out);
 
-  av_freep(&frame_2->data[0]);
-  av_frame_free(&frame_2);
+  return ssim_value;
+}
+
+double compare_ssim_native(AVFrame *frame_1, AVFrame *frame_2) {
+  return vm_ssim::ssim(frame_1->data[0], frame_1->linesize[0],
+                       frame_2->data[0], frame_2->linesize[0], frame_1->width,
+                       frame_1->height);
+}
+
+double compare_ssim(const vm_option::job &job, AVFrame *frame_1,
+                    AVFrame *frame_2, fnum frame_num) {
+  double ssim_value;
+  switch (job.ssim_mode) {
+  case vm_option::ssim_mode_enum::lavfi:
+    ssim_value = compare_ssim_lavfi(frame_1, frame_2);
+    break;
+  case vm_option::ssim_mode_enum::check: {
+    ssim_value = compare_ssim_native(frame_1, frame_2);
+    double ssim_lavfi = compare_ssim_lavfi(frame_1, frame_2);
+    if (std::abs(ssim_value - ssim_lavfi) > ssim_check_tolerance)
+      vm_log::warning(std::format(
+          "vm_match::compare_ssim: {0} SSIM mismatch: native {1} lavfi {2}",
+          frame_num, ssim_value, ssim_lavfi));
+    break;
+  }
+  default:
+    ssim_value = compare_ssim_native(frame_1, frame_2);
+    break;
+  }
 
   if (vm_option::param::debug)
-    vm_log::info(std::format("{0} SSIM: {1}", video_frame_num_1, ssim_value));
+    vm_log::info(std::format("{0} SSIM: {1}", frame_num, ssim_value));
 
   return ssim_value;
 }
 
-bool frame_cmp(AVFrame *&frame_1, AVFrame *&frame_2) {
-  bool is_pass =
-      compare_ssim(frame_1, frame_2) >= vm_option::param::ssim_threshold;
-  if (is_pass) {
-    av_freep(&frame_1->data[0]);
-    av_frame_free(&frame_1);
+bool frame_cmp(const vm_option::job &job, const vm_frame::frame *frame_1,
+               const vm_frame::frame *frame_2, fnum frame_num) {
+  // 签名给出的上界达不到阈值，跳过 SSIM
+  double bound = vm_ssim::upper_bound(frame_1->sig, frame_2->sig);
+  if (job.prefilter && bound + prefilter_margin < job.ssim_threshold) {
+    vm_stats::add(vm_stats::counter::prune);
+    return false;
   }
-  return is_pass;
+
+  vm_stats::add(vm_stats::counter::compare);
+  double ssim_value;
+  {
+    vm_stats::timer timer(vm_stats::stage::ssim);
+    ssim_value = compare_ssim(job, frame_1->gray, frame_2->gray, frame_num);
+  }
+  if (job.ssim_mode == vm_option::ssim_mode_enum::check &&
+      ssim_value > bound + prefilter_margin)
+    vm_log::warning(std::format(
+        "vm_match::frame_cmp: {0} SSIM {1} exceeds prefilter bound {2}",
+        frame_num, ssim_value, bound));
+
+  return ssim_value >= job.ssim_threshold;
 }
 
-void do_match() {
-  match_frame_list = new fnum[vm_option::frame_count_1];
-  buffer_read_pos = video_frame_num_1 = 0;
-  can_not_flush_buffer = false;
-  AVFrame *frame_1 = av_frame_alloc(), *frame_2 = av_frame_alloc();
-  AVFrame *frame_1_resize, *frame_2_resize;
-  AVPacket packet_1;
+// 预测 frame_1 在 video 2 中的帧号，-pts 时按时间线换算
+// 有上次匹配时保持其偏移，否则按 PTS 换算，都没有时从窗口起点开始
+fnum _predict_frame_2(const _run &run, const vm_frame::frame *frame_1) {
+  const vm_option::job &job = *run.job;
+  if (job.pts)
+    return _predict_pts(run);
+  if (run.last_match_2 >= 0)
+    return run.last_match_2 + (run.video_frame_num_1 - run.last_match_1);
 
-  // 配置 SSIM 滤镜
-  init_ssim_filter_graph();
-
-  // 打印进度子线程
-  std::thread([&]() {
-    fnum denominator = vm_option::frame_count_1 - 1;
-    while (true) {
-      vm_log::change_title(
-          std::format(R"({0} / {1} {2:.1f}%)", video_frame_num_1, denominator,
-                      100.0 * video_frame_num_1 / denominator));
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  AVRational frame_rate_2 = run.video_2->frame_rate;
+  if (frame_1->pts != AV_NOPTS_VALUE && job.formatContext_1 &&
+      frame_rate_2.num > 0) {
+    const AVStream *stream =
+        job.formatContext_1->streams[job.video_stream_index_1];
+    int64_t pts = frame_1->pts;
+    if (stream->start_time != AV_NOPTS_VALUE)
+      pts -= stream->start_time;
+    return static_cast<fnum>(std::lround(
+        pts * av_q2d(stream->time_base) * av_q2d(frame_rate_2)));
+  }
+
+  return run.frame_buffer->begin();
+}
+
+void _lower_best(std::atomic<size_t> &best, size_t i) {
+  for (size_t cur = best.load();
+       i < cur && !best.compare_exchange_weak(cur, i);)
+    ;
+}
+
+// 并行对比候选 [0, count) 中未跳过的，返回最靠前的通过者，没有时返回 count
+size_t _first_match(_run &run, const vm_frame::frame *frame_1, size_t count,
+                    const std::vector<uint8_t> *skip = nullptr) {
+  std::atomic<size_t> best = count;
+  pool->parallel_for(count, [&](size_t i) {
+    // 已有更靠前的候选通过，取消
+    if (i >= best.load() || (skip && (*skip)[i]))
+      return;
+    if (frame_cmp(*run.job, frame_1, run.candidates[i].second,
+                  run.video_frame_num_1))
+      _lower_best(best, i);
+  });
+  return best;
+}
+
+// -pyramid: 按粗筛层 SSIM 排序，先精细验证得分最高的几个
+// 之后再验证探测顺序更靠前的其余候选，保证与单尺度结果一致
+size_t _pyramid_match(_run &run, const vm_frame::frame *frame_1) {
+  size_t count = run.candidates.size();
+  size_t top = std::min<size_t>(count, run.job->pyramid);
+
+  run.score.resize(count);
+  pool->parallel_for(count, [&](size_t i) {
+    vm_stats::timer timer(vm_stats::stage::coarse);
+    const AVFrame *coarse_1 = frame_1->coarse;
+    const AVFrame *coarse_2 = run.candidates[i].second->coarse;
+    run.score[i] = vm_ssim::ssim(coarse_1->data[0], coarse_1->linesize[0],
+                                 coarse_2->data[0], coarse_2->linesize[0],
+                                 coarse_1->width, coarse_1->height);
+  });
+  vm_stats::add(vm_stats::counter::coarse, count);
+
+  run.rank.resize(count);
+  std::iota(run.rank.begin(), run.rank.end(), 0);
+  std::partial_sort(run.rank.begin(), run.rank.begin() + top, run.rank.end(),
+                    [&](size_t a, size_t b) {
+                      return run.score[a] > run.score[b] ||
+                             (run.score[a] == run.score[b] && a < b);
+                    });
+
+  std::atomic<size_t> best = count;
+  pool->parallel_for(top, [&](size_t j) {
+    size_t i = run.rank[j];
+    if (i < best.load() && frame_cmp(*run.job, frame_1,
+                                     run.candidates[i].second,
+                                     run.video_frame_num_1))
+      _lower_best(best, i);
+  });
+
+  run.verified.assign(count, 0);
+  for (size_t j = 0; j < top; ++j)
+    run.verified[run.rank[j]] = 1;
+  return _first_match(run, frame_1, best, &run.verified);
+}
+
+// 自适应窗口: 连续 forward_grow_misses 帧未匹配时 forward 加倍
+// 以不变的偏移连续匹配 2 * forward 帧后减半，范围为 [forward_min, forward_max]
+void _adapt_forward(_run &run, bool matched, bool steady) {
+  const vm_option::job &job = *run.job;
+  int forward = run.forward;
+  if (!matched) {
+    run.steady = 0;
+    if (++run.misses >= forward_grow_misses) {
+      run.misses = 0;
+      forward = std::min<int>(job.forward_max, 2 * forward);
+    }
+  } else {
+    run.misses = 0;
+    run.steady = steady ? run.steady + 1 : 0;
+    if (run.steady >= 2 * forward) {
+      run.steady = 0;
+      forward = std::max<int>(job.forward_min, forward / 2);
     }
-  }).detach();
+  }
+  if (forward == run.forward)
+    return;
 
-  // 读取并对比
-  while (av_read_frame(vm_option::formatContext_1, &packet_1) >= 0) {
-    if (packet_1.stream_index == vm_option::video_stream_index_1) {
-      if (avcodec_send_packet(vm_option::codecContext_1, &packet_1) == 0) {
-        while (avcodec_receive_frame(vm_option::codecContext_1, frame_1) == 0) {
-          // 执行
-
-          // vm_log::info(std::format("{0}",video_frame_num_1));
-
-          frame_1_resize = _auto_pix_fmt_process(frame_1);
-          _flush_buffer();
-          bool is_not_finded = true;
-          for (auto p : frame_buffer_map) {
-            frame_2 = p.second;
-            frame_2_resize = _auto_pix_fmt_process(frame_2);
-
-            if (frame_cmp(frame_1_resize, frame_2_resize)) {
-              frame_buffer_map.erase(p.first);
-              match_frame_list[video_frame_num_1] = p.first;
-              is_not_finded = false;
-              break;
-            }
-          }
-          if (is_not_finded)
-            match_frame_list[video_frame_num_1] = -1;
+  if (run.video_frame_num_1 >= run.output_begin) {
+    vm_stats::add(forward > run.forward ? vm_stats::counter::forward_grow
+                                        : vm_stats::counter::forward_shrink);
+    if (vm_option::param::debug)
+      vm_log::info(std::format("{0} forward: {1} -> {2}",
+                               run.video_frame_num_1, run.forward, forward));
+  }
+  run.forward = forward;
+}
 
-          ++video_frame_num_1;
-        }
-      }
+// -resync: video 1 的镜头切换帧在窗口中未找到匹配，且之前已连续未匹配时调用
+// 先把 video 2 的镜头切换索引向后扩展至多 resync_lookahead 帧
+// 窗口外签名上界不低于阈值的切换按上界从高到低取出，逐个解码并用 SSIM 验证
+// 跳到第一个通过的切换处，从该处继续局部匹配
+// 都不通过时窗口与读取位置保持不变，返回是否跳转
+bool _resync(_run &run, const vm_frame::frame *frame_1) {
+  vm_stats::timer timer(vm_stats::stage::window);
+  const vm_option::job &job = *run.job;
+  const vm_option::video_2 &video = *run.video_2;
+
+  fnum limit = run.indexed_2 + vm_option::resync_lookahead;
+  // decoder_2 是否已离开 buffer_read_pos
+  bool moved = false;
+  if (video.index) {
+    for (fnum i = run.indexed_2; i < limit && i < video.index->size(); ++i) {
+      vm_frame::frame *frame = video.index->get(i);
+      _index_cut(run, i, frame->sig);
+      delete frame;
     }
-    av_packet_unref(&packet_1);
+  } else if (run.indexed_2 < run.timeline_2->size()) {
+    // 之前的帧已在索引中，只解码不放入窗口
+    if (run.pending_2 || run.pending_num_2 + 1 != run.indexed_2)
+      _seek_2(run, run.indexed_2);
+    while (run.indexed_2 < limit && _pop_2(run))
+      ;
+    moved = true;
   }
 
-  // 发空包，以防缓冲区中仍有帧
-  if (avcodec_send_packet(vm_option::codecContext_1, nullptr) == 0) {
-    while (avcodec_receive_frame(vm_option::codecContext_1, frame_1) >= 0) {
-      // 执行
-      // vm_log::info(std::format("{0}", video_frame_num_1));
-      frame_1_resize = _auto_pix_fmt_process(frame_1);
+  // 窗口内的切换已由局部匹配对比过，上界相同时离当前位置近的在前
+  fnum here = run.video_frame_num_1 + run.offset;
+  std::vector<std::pair<double, fnum>> targets;
+  for (const auto &[frame_num, sig] : run.cuts_2) {
+    if ((frame_num >= run.frame_buffer->begin() &&
+         frame_num < run.frame_buffer->end()) ||
+        frame_num >= video.frame_count)
+      continue;
+    double bound = vm_ssim::upper_bound(frame_1->sig, sig);
+    if (bound + prefilter_margin >= job.ssim_threshold)
+      targets.emplace_back(bound, frame_num);
+  }
+  size_t count = std::min(targets.size(), resync_candidates);
+  std::partial_sort(targets.begin(), targets.begin() + count, targets.end(),
+                    [&](const auto &a, const auto &b) {
+                      return a.first > b.first ||
+                             (a.first == b.first &&
+                              std::abs(a.second - here) <
+                                  std::abs(b.second - here));
+                    });
 
-      bool is_not_finded = true;
-      for (auto p : frame_buffer_map) {
+  fnum target = -1;
+  for (size_t i = 0; i < count && target == -1; ++i) {
+    fnum frame_num = targets[i].second;
+    bool passed = false;
+    if (video.index) {
+      vm_frame::frame *frame_2 = video.index->get(frame_num);
+      passed = frame_cmp(job, frame_1, frame_2, run.video_frame_num_1);
+      delete frame_2;
+    } else {
+      // 通过时 pending_2 即为跳转后读入窗口的第一帧
+      _seek_2(run, frame_num);
+      moved = true;
+      while (run.pending_num_2 < frame_num && _pop_2(run))
+        ;
+      passed = run.pending_2 && run.pending_num_2 == frame_num &&
+               frame_cmp(job, frame_1, run.pending_2, run.video_frame_num_1);
+    }
+    if (passed)
+      target = frame_num;
+  }
 
-        frame_2 = p.second;
-        frame_2_resize = _auto_pix_fmt_process(frame_2);
+  if (target == -1) {
+    // 回到原来的读取位置，回不去时之前的帧已无法读入
+    if (moved && !_seek_2(run, run.buffer_read_pos)) {
+      vm_log::error(std::format(
+          "vm_match::_resync: can not return to frame {0} of video 2",
+          run.buffer_read_pos));
+      run.can_not_flush_buffer = true;
+    }
+    return false;
+  }
 
-        if (frame_cmp(frame_1_resize, frame_2_resize)) {
-          frame_buffer_map.erase(p.first);
-          match_frame_list[video_frame_num_1] = p.first;
-          is_not_finded = false;
-          break;
-        }
+  if (run.video_frame_num_1 >= run.output_begin) {
+    vm_stats::add(vm_stats::counter::resync);
+    if (vm_option::param::debug)
+      vm_log::info(std::format("{0} resync: video 2 {1} -> {2}",
+                               run.video_frame_num_1, here, target));
+  }
+
+  // 以 target 作为当前帧的预测位置
+  run.frame_buffer->clear();
+  run.buffer_read_pos = target;
+  run.offset = target - run.video_frame_num_1;
+  run.last_match_1 = run.video_frame_num_1;
+  run.last_match_2 = target;
+  run.miss_streak = 0;
+  run.can_not_flush_buffer = false;
+  _report_window(run);
+  return true;
+}
+
+// 两幅尺寸相同的 GRAY8 图像像素是否完全相同
+bool _same_pixels(const AVFrame *a, const AVFrame *b) {
+  for (int y = 0; y < a->height; ++y)
+    if (std::memcmp(a->data[0] + static_cast<ptrdiff_t>(y) * a->linesize[0],
+                    b->data[0] + static_cast<ptrdiff_t>(y) * b->linesize[0],
+                    a->width))
+      return false;
+  return true;
+}
+
+// 在窗口中查找与 frame_1 匹配的帧，返回 run.candidates 中的位置，没有时返回其大小
+// 候选从预测位置 predict 向两侧展开，按此顺序并行对比
+// 最靠前的通过者胜出，与串行结果一致
+// 窗口中有像素完全相同的帧时它必然通过，只需对比探测顺序在它之前的候选
+size_t _search(_run &run, const vm_frame::frame *frame_1, fnum &predict) {
+  vm_window::window &frame_buffer = *run.frame_buffer;
+  run.candidates.clear();
+  auto add = [&](fnum i) {
+    if (vm_frame::frame *frame_2 = frame_buffer.find(i))
+      run.candidates.emplace_back(i, frame_2);
+  };
+  fnum begin = frame_buffer.begin(), end = frame_buffer.end();
+  predict = std::clamp(_predict_frame_2(run, frame_1), begin,
+                       std::max(begin, end - 1));
+  add(predict);
+  for (fnum hi = predict + 1, lo = predict - 1; hi < end || lo >= begin;) {
+    if (hi < end)
+      add(hi++);
+    if (lo >= begin)
+      add(lo--);
+  }
+
+  if (run.job->hash) {
+    fnum same = frame_buffer.find_hash(frame_1->hash, predict);
+    size_t exact = 0;
+    if (same != -1)
+      while (run.candidates[exact].first != same)
+        ++exact;
+    // 逐字节确认，哈希碰撞时按普通方式查找
+    if (same != -1 &&
+        _same_pixels(frame_1->gray, run.candidates[exact].second->gray)) {
+      size_t best = _first_match(run, frame_1, exact);
+      if (best == exact && run.video_frame_num_1 >= run.output_begin)
+        vm_stats::add(vm_stats::counter::exact);
+      return best;
+    }
+  }
+
+  int pyramid = run.job->pyramid;
+  return pyramid && run.candidates.size() > static_cast<size_t>(pyramid)
+             ? _pyramid_match(run, frame_1)
+             : _first_match(run, frame_1, run.candidates.size());
+}
+
+// 匹配 frame_1 并记录结果，frame_1 为预处理后的帧，由调用者释放
+// cut_1 表示 frame_1 是 video 1 的镜头切换
+void _match_frame(_run &run, vm_frame::frame *frame_1, bool cut_1) {
+  // 预测来自上次匹配的偏移
+  bool have_offset = run.last_match_2 >= 0;
+  fnum predict;
+  size_t best = _search(run, frame_1, predict);
+
+  // -resync: 跳到匹配的镜头切换处后再找一次
+  if (best == run.candidates.size() && cut_1 && run.resync &&
+      run.miss_streak >= run.resync && _resync(run, frame_1)) {
+    _flush_buffer(run);
+    best = _search(run, frame_1, predict);
+  }
+
+  fnum result = -1;
+  if (best < run.candidates.size()) {
+    result = run.candidates[best].first;
+    run.frame_buffer->consume(run.candidates[best].first);
+    run.last_match_1 = run.video_frame_num_1;
+    run.last_match_2 = run.candidates[best].first;
+    if (run.video_frame_num_1 >= run.output_begin) {
+      vm_stats::hit(best);
+      if (best == 0 && run.candidates[0].first == predict)
+        vm_stats::add(vm_stats::counter::first_probe);
+    }
+  }
+
+  _adapt_forward(run, result != -1, have_offset && result == predict);
+  run.miss_streak = result == -1 ? run.miss_streak + 1 : 0;
+  _set_result(run, result);
+}
+
+// 匹配 video 1 的帧 [video_frame_num_1, end)，各 run 从同一帧开始
+// video 1 由 runs[0].decoder_1 解码一次，每帧依次与各 video 2 的窗口匹配
+// 解码失败缺失的帧记为 -1，返回 runs[0] 在 end 处的状态
+_boundary _match_range(std::span<_run> runs, fnum end) {
+  _run &first = runs.front();
+  // -resync 只在 video 1 的镜头切换处跳转
+  vm_ssim::signature last_sig_1;
+  bool have_last_1 = false;
+  while (first.video_frame_num_1 < end) {
+    vm_frame::frame *frame_1 = first.decoder_1->pop();
+    if (!frame_1)
+      break;
+
+    fnum frame_num = first.timeline_1 ? first.timeline_1->index(frame_1->pts)
+                                      : first.video_frame_num_1;
+    // 定位点之前的帧
+    if (frame_num < first.video_frame_num_1) {
+      delete frame_1;
+      continue;
+    }
+    if (frame_num >= end) {
+      delete frame_1;
+      break;
+    }
+
+    bool cut_1 =
+        first.job->resync &&
+        (!have_last_1 ||
+         vm_ssim::upper_bound(last_sig_1, frame_1->sig) < scene_cut_bound);
+    last_sig_1 = frame_1->sig;
+    have_last_1 = true;
+
+    for (_run &run : runs)
+      while (run.video_frame_num_1 <= frame_num) {
+        if (run.video_frame_num_1 == run.output_begin)
+          run.entry = _capture(run);
+        _flush_buffer(run);
+        if (run.video_frame_num_1 == frame_num)
+          _match_frame(run, frame_1, cut_1);
+        else
+          _set_result(run, -1);
       }
-      if (is_not_finded)
-        match_frame_list[video_frame_num_1] = -1;
+    delete frame_1;
+  }
+  return _capture(first);
+}
+
+// 分段并行匹配中的一段
+struct _segment {
+  fnum start;        // 从此帧开始匹配，之前的结果只用于预热窗口
+  fnum begin, end;   // 输出结果的帧号范围
+  std::vector<fnum> match_list; // 从 start 开始
+  _boundary entry, exit;
+};
+
+// _match_segment 解码 video 1 与 video 2 的上下文
+struct _contexts {
+  AVFormatContext *format_ctx_1 = nullptr, *format_ctx_2 = nullptr;
+  AVCodecContext *codec_ctx_1 = nullptr, *codec_ctx_2 = nullptr;
+  int8_t stream_index_1 = -1, stream_index_2 = -1;
+};
+
+// 匹配一段，seed 为空时从 start 处的初始状态开始
+// claimed_2 中标记的 video 2 帧不作为候选
+// shared 为空时打开独立的解码上下文，否则定位 shared 后使用，用完不关闭
+void _match_segment(const vm_option::job &job,
+                    const vm_option::video_2 &video, _segment &segment,
+                    const vm_segment::timeline &timeline_1,
+                    const vm_segment::timeline &timeline_2,
+                    const _boundary *seed,
+                    const std::vector<uint8_t> *claimed_2 = nullptr,
+                    const _contexts *shared = nullptr) {
+  _boundary state =
+      seed ? *seed : _initial_boundary(job, video, segment.start);
+
+  _contexts own;
+  if (!shared) {
+    vm_option::open_video(job, 1, job.input_video_path_1, own.format_ctx_1,
+                          own.codec_ctx_1, own.stream_index_1);
+    if (!video.index)
+      vm_option::open_video(job, 2, video.input_video_path, own.format_ctx_2,
+                            own.codec_ctx_2, own.stream_index_2);
+  }
+  const _contexts &ctx = shared ? *shared : own;
+  vm_segment::seek(ctx.format_ctx_1, ctx.codec_ctx_1, ctx.stream_index_1,
+                   timeline_1, segment.start);
+  if (!video.index)
+    vm_segment::seek(ctx.format_ctx_2, ctx.codec_ctx_2, ctx.stream_index_2,
+                     timeline_2, state.window_begin);
+
+  {
+    _run run;
+    run.job = &job;
+    run.video_2 = &video;
+    segment.match_list.clear();
+    segment.match_list.reserve(segment.end - segment.start);
+    run.match_list = &segment.match_list;
+    run.output_begin = segment.begin;
+    run.timeline_1 = &timeline_1;
+    run.timeline_2 = &timeline_2;
+    run.claimed_2 = claimed_2;
+    run.frame_buffer = _new_window(job);
+    run.decoder_1 = new vm_decode::decoder(
+        1, ctx.format_ctx_1, ctx.codec_ctx_1, ctx.stream_index_1,
+        decode_queue_size_1, _process(job));
+    if (!video.index) {
+      run.format_ctx_2 = ctx.format_ctx_2;
+      run.codec_ctx_2 = ctx.codec_ctx_2;
+      run.stream_index_2 = ctx.stream_index_2;
+      _new_decoder_2(run);
+    }
+
+    run.video_frame_num_1 = segment.start;
+    _restore(run, state);
+    segment.exit = _match_range(std::span(&run, 1), segment.end);
+    segment.entry = run.entry;
+  }
+
+  avformat_close_input(&own.format_ctx_1);
+  avformat_close_input(&own.format_ctx_2);
+  avcodec_free_context(&own.codec_ctx_1);
+  avcodec_free_context(&own.codec_ctx_2);
+}
+
+// 进度的总帧数改为 job 当前的帧数
+void _update_total(const vm_option::job &job) {
+  if (progress)
+    progress->set_total(job.frame_count_1);
+}
+
+// -segments: 在关键帧处切分 video 1，各段在独立线程中匹配
+// 每段先从提前一个窗口容量的帧处预热，使窗口内已匹配的帧与单次匹配一致
+// 衔接处状态与前一段结束时不同时，以前一段的状态为起点重新匹配该段
+// 只用于一个 video 2，返回 false 表示无法分段
+bool _match_segments(vm_option::job &job, vm_output::output &output) {
+  vm_option::video_2 &video = job.videos_2[0];
+  vm_segment::timeline timeline_1, timeline_2;
+  if (!vm_segment::scan(job.input_video_path_1, job.video_stream_index_1,
+                        timeline_1) ||
+      (!video.index && !vm_segment::scan(video.input_video_path,
+                                         video.video_stream_index,
+                                         timeline_2))) {
+    vm_log::warning("Missing or duplicate PTS, -segments is disabled");
+    return false;
+  }
+
+  // 时间线给出准确帧数
+  job.frame_count_1 = timeline_1.size();
+  if (!video.index)
+    video.frame_count = timeline_2.size();
+  _update_total(job);
+
+  fnum warmup = static_cast<fnum>(_window_capacity(job));
+  std::vector<fnum> starts =
+      vm_segment::split(timeline_1, job.segments, warmup);
+  if (starts.size() < 2) {
+    vm_log::warning("Too few keyframes, -segments is disabled");
+    return false;
+  }
+
+  std::vector<_segment> segments(starts.size());
+  for (size_t i = 0; i < segments.size(); ++i) {
+    segments[i].begin = starts[i];
+    segments[i].end =
+        i + 1 < starts.size() ? starts[i + 1] : job.frame_count_1;
+    segments[i].start = std::max(0, segments[i].begin - warmup);
+  }
 
-      ++video_frame_num_1;
+  std::vector<std::jthread> workers;
+  for (_segment &segment : segments)
+    workers.emplace_back([&] {
+      _match_segment(job, video, segment, timeline_1, timeline_2, nullptr);
+    });
+
+  // 按顺序衔接并写出，之后的段仍在匹配
+  size_t rerun = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    _segment &segment = segments[i];
+    workers[i].join();
+    if (i && segment.entry != segments[i - 1].exit) {
+      ++rerun;
+      segment.start = segment.begin;
+      _match_segment(job, video, segment, timeline_1, timeline_2,
+                     &segments[i - 1].exit);
+    }
+
+    // 解码提前结束的帧记为 -1
+    for (fnum j = segment.begin; j < segment.end; ++j) {
+      size_t k = j - segment.start;
+      output.write(j, k < segment.match_list.size() ? segment.match_list[k]
+                                                    : -1);
+    }
+    std::vector<fnum>().swap(segment.match_list);
+  }
+
+  if (vm_option::param::benchmark || vm_option::param::debug)
+    vm_log::info(std::format("segments: {0}, {1} rematched at the boundary",
+                             segments.size(), rerun));
+  return true;
+}
+
+// 流参数与附加数据相同时，相同的包解码出相同的帧
+bool _same_codec(const AVCodecParameters *a, const AVCodecParameters *b) {
+  return a->codec_id == b->codec_id && a->width == b->width &&
+         a->height == b->height && a->format == b->format &&
+         a->extradata_size == b->extradata_size &&
+         (!a->extradata_size ||
+          !std::memcmp(a->extradata, b->extradata, a->extradata_size));
+}
+
+// 帧 frame_num - 1 按包对齐到 video 2 的 frame_2 时，frame_num 开始匹配前的状态
+// 窗口以对齐的偏移为中心
+_boundary _packet_boundary(const vm_option::job &job,
+                           const vm_option::video_2 &video, fnum frame_num,
+                           fnum frame_2) {
+  _boundary result;
+  fnum forward = job.frame_forward;
+  result.forward = forward;
+  result.offset = frame_2 + 1 - frame_num;
+  result.last_match_1 = frame_num - 1;
+  result.last_match_2 = frame_2;
+  result.window_begin = std::clamp(frame_2 - forward, 0, video.frame_count);
+  result.window_end = result.read_pos =
+      std::clamp(frame_2 + 1 + forward, 0, video.frame_count);
+  return result;
+}
+
+// -packet: 先按包哈希对齐，对齐的帧直接写出，不解码
+// 连续未对齐的帧作为一段，从之前最近的关键帧解码，以前一帧的对齐偏移为起点匹配
+// 已对齐的 video 2 帧在各段中都不作为候选，结果中每帧至多出现一次
+// 只用于一个 video 2，返回 false 表示无法按包对齐
+bool _match_packets(vm_option::job &job, vm_output::output &output) {
+  vm_option::video_2 &video = job.videos_2[0];
+  if (video.index) {
+    vm_log::warning("The second video is an index, -packet is disabled");
+    return false;
+  }
+  if (!_same_codec(
+          job.formatContext_1->streams[job.video_stream_index_1]->codecpar,
+          video.formatContext->streams[video.video_stream_index]->codecpar)) {
+    vm_log::warning("Codec parameters differ, -packet is disabled");
+    return false;
+  }
+
+  vm_segment::timeline timeline_1, timeline_2;
+  std::vector<fnum> result;
+  {
+    std::vector<vm_segment::packet> packets_1, packets_2;
+    bool valid_1, valid_2;
+    {
+      // 两个文件同时读取
+      std::jthread scan_2([&] {
+        valid_2 = vm_segment::scan(video.input_video_path,
+                                   video.video_stream_index, timeline_2,
+                                   &packets_2);
+      });
+      valid_1 = vm_segment::scan(job.input_video_path_1,
+                                 job.video_stream_index_1, timeline_1,
+                                 &packets_1);
+    }
+    if (!valid_1 || !valid_2) {
+      vm_log::warning("Missing or duplicate PTS, -packet is disabled");
+      return false;
+    }
+    result = vm_segment::align(packets_1, timeline_1.size(), packets_2,
+                               timeline_2.size());
+  }
+
+  // 时间线给出准确帧数
+  job.frame_count_1 = timeline_1.size();
+  video.frame_count = timeline_2.size();
+  _update_total(job);
+  std::vector<uint8_t> used_2(video.frame_count, 0);
+  for (fnum frame_2 : result)
+    if (frame_2 != -1)
+      used_2[frame_2] = 1;
+
+  // 各段依次匹配，共用 open 打开的上下文，段之间定位
+  _contexts shared;
+  shared.format_ctx_1 = job.formatContext_1;
+  shared.codec_ctx_1 = job.codecContext_1;
+  shared.stream_index_1 = job.video_stream_index_1;
+  shared.format_ctx_2 = video.formatContext;
+  shared.codec_ctx_2 = video.codecContext;
+  shared.stream_index_2 = video.video_stream_index;
+
+  size_t gaps = 0;
+  for (fnum begin = 0, end; begin < job.frame_count_1; begin = end) {
+    end = begin;
+    if (result[begin] != -1) {
+      for (; end < job.frame_count_1 && result[end] != -1; ++end)
+        output.write(end, result[end]);
+      for (vm_stats::counter c :
+           {vm_stats::counter::frames_1, vm_stats::counter::matched,
+            vm_stats::counter::packet})
+        vm_stats::add(c, end - begin);
+      continue;
+    }
+
+    while (end < job.frame_count_1 && result[end] == -1)
+      ++end;
+    _segment segment;
+    segment.start = segment.begin = begin;
+    segment.end = end;
+    if (begin) {
+      _boundary seed = _packet_boundary(job, video, begin, result[begin - 1]);
+      _match_segment(job, video, segment, timeline_1, timeline_2, &seed,
+                     &used_2, &shared);
+    } else
+      _match_segment(job, video, segment, timeline_1, timeline_2, nullptr,
+                     &used_2, &shared);
+
+    // 解码提前结束的帧记为 -1
+    for (fnum j = begin; j < end; ++j) {
+      size_t k = j - begin;
+      output.write(j, k < segment.match_list.size() ? segment.match_list[k]
+                                                    : -1);
+    }
+    ++gaps;
+  }
+
+  if (vm_option::param::benchmark || vm_option::param::debug)
+    vm_log::info(std::format(
+        "packet: {0} of {1} frames aligned, {2} ranges decoded",
+        vm_stats::get(vm_stats::counter::packet), job.frame_count_1, gaps));
+  return true;
+}
+
+// 不分段时结果直接写出，帧数不受 frame_count_1 的猜测值限制
+// video 1 只解码一次，outputs[k] 为 videos_2[k] 的输出
+void _match_single(const vm_option::job &job,
+                   std::vector<std::unique_ptr<vm_output::output>> &outputs) {
+  std::vector<_run> runs(job.videos_2.size());
+  for (size_t k = 0; k < runs.size(); ++k) {
+    _run &run = runs[k];
+    const vm_option::video_2 &video = job.videos_2[k];
+    run.job = &job;
+    run.video_2 = &video;
+    run.output = outputs[k].get();
+    run.count_frames_1 = k == 0;
+    run.forward = job.frame_forward;
+    run.frame_buffer = _new_window(job);
+
+    // 有时间线时按 PTS 换算帧号，-resync 与 -pts 据此定位
+    if (!video.index && video.timeline.size())
+      run.timeline_2 = &video.timeline;
+    run.resync = video.index || run.timeline_2 ? job.resync : 0;
+
+    // 各视频在独立线程中解码并预处理
+    if (!video.index) {
+      run.format_ctx_2 = video.formatContext;
+      run.codec_ctx_2 = video.codecContext;
+      run.stream_index_2 = video.video_stream_index;
+      _new_decoder_2(run);
     }
   }
+  if (job.pts)
+    runs[0].timeline_1 = &job.timeline_1;
+  runs[0].decoder_1 = new vm_decode::decoder(
+      1, job.formatContext_1, job.codecContext_1, job.video_stream_index_1,
+      decode_queue_size_1, _process(job));
+
+  _match_range(runs, std::numeric_limits<fnum>::max());
+}
+
+// 匹配一个已打开的 job，to_stdout 为 false 时只写 -log 文件
+void _match_job(vm_option::job &job, bool to_stdout) {
+  std::vector<std::unique_ptr<vm_output::output>> outputs;
+  for (const vm_option::video_2 &video : job.videos_2)
+    outputs.push_back(std::make_unique<vm_output::output>(
+        job, video, to_stdout && job.videos_2.size() == 1));
+
+  // 配置 SSIM 滤镜
+  if (job.ssim_mode != vm_option::ssim_mode_enum::native)
+    init_ssim_filter_graph(job);
+
+  // 读取并对比
+  if ((!job.packet || !_match_packets(job, *outputs[0])) &&
+      (job.segments <= 1 || !_match_segments(job, *outputs[0])))
+    _match_single(job, outputs);
+
+  avfilter_graph_free(&ssim_graph);
+}
+
+// -jobs: 最多 -concurrency 个 job 同时匹配，共用对比线程池与窗口
+// 每个 job 在匹配前打开，结束后立即关闭
+// 出错的 job 记录后跳过，返回失败的 job 数
+size_t _match_jobs(std::vector<vm_option::job> &jobs) {
+  std::atomic<size_t> next = 0, failed = 0;
+  {
+    std::vector<std::jthread> workers;
+    for (int i = 0; i < vm_option::param::concurrency; ++i)
+      workers.emplace_back([&] {
+        for (size_t k; (k = next++) < jobs.size();) {
+          vm_option::job &job = jobs[k];
+          if (!job.failed)
+            try {
+              vm_log::job_scope scope;
+              vm_option::open(job);
+            } catch (const vm_log::job_error &) {
+              job.failed = true;
+            }
+          if (job.failed) {
+            vm_option::close(job);
+            ++failed;
+            vm_log::error(std::format("job {0} / {1} failed: \"{2}\"", k + 1,
+                                      jobs.size(), job.input_video_path_1));
+            continue;
+          }
+          _match_job(job, false);
+          vm_option::close(job);
+          if (vm_option::param::benchmark || vm_option::param::debug)
+            vm_log::info(std::format("job {0} / {1} done: \"{2}\"", k + 1,
+                                     jobs.size(), job.input_video_path_1));
+        }
+      });
+  }
+  return failed;
+}
+
+bool do_match(std::vector<vm_option::job> &jobs) {
+  vm_stats::reset();
+  size_t failed = 0;
+
+  pool = new vm_pool::pool(vm_option::param::threads - 1);
+
+  {
+    // 进度标题与 -progress 记录，匹配结束时停止
+    // 多个 job 时总帧数在打开之前未知
+    vm_progress::reporter reporter(jobs.size() == 1 ? jobs[0].frame_count_1
+                                                    : 0,
+                                   _window_capacity(jobs[0]));
+
+    if (vm_option::param::jobs_path.empty()) {
+      progress = &reporter;
+      _update_total(jobs[0]);
+      _match_job(jobs[0], true);
+      vm_option::close(jobs[0]);
+      progress = nullptr;
+    } else
+      failed = _match_jobs(jobs);
+  }
+
+  if (failed)
+    vm_log::error(std::format("{0} of {1} jobs failed", failed, jobs.size()));
+
+  if (vm_option::param::benchmark || vm_option::param::debug) {
+    uint64_t compared = vm_stats::get(vm_stats::counter::compare),
+             pruned = vm_stats::get(vm_stats::counter::prune),
+             first_probe = vm_stats::get(vm_stats::counter::first_probe),
+             frames = vm_stats::get(vm_stats::counter::frames_1);
+    vm_log::info(std::format(
+        "prefilter: {0} SSIM comparisons, {1} pruned ({2:.1f}%)", compared,
+        pruned, 100.0 * pruned / std::max<uint64_t>(1, compared + pruned)));
+    vm_log::info(std::format(
+        "scan: {0:.2f} SSIM comparisons per frame, first probe hit {1} of {2} "
+        "frames ({3:.1f}%)",
+        static_cast<double>(compared) / std::max<uint64_t>(1, frames),
+        first_probe, frames,
+        100.0 * first_probe / std::max<uint64_t>(1, frames)));
+    if (uint64_t coarse = vm_stats::get(vm_stats::counter::coarse))
+      vm_log::info(std::format("pyramid: {0} coarse SSIM comparisons", coarse));
+    uint64_t grow = vm_stats::get(vm_stats::counter::forward_grow),
+             shrink = vm_stats::get(vm_stats::counter::forward_shrink);
+    if (grow || shrink)
+      vm_log::info(std::format("forward: {0} grown, {1} shrunk", grow, shrink));
+    if (uint64_t resync = vm_stats::get(vm_stats::counter::resync))
+      vm_log::info(std::format("resync: {0} jumps", resync));
+  }
 
   // 清理
-  av_frame_free(&frame_1);
-  avformat_close_input(&vm_option::formatContext_1);
-  avformat_close_input(&vm_option::formatContext_2);
-  avcodec_free_context(&vm_option::codecContext_1);
-  avcodec_free_context(&vm_option::codecContext_2);
+  _clear_window_cache();
+  delete pool;
+  pool = nullptr;
+  return !failed;
 }
 
 } // namespace vm_match
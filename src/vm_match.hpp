@@ -1,11 +1,29 @@
 #pragma once
 
+extern "C" {
+#include <libavutil/frame.h>
+}
+#include <vector>
+
+#include "vm_frame.hpp"
+#include "vm_option.hpp"
 #include "vm_type.hpp"
 
 namespace vm_match {
 
-extern fnum *match_frame_list;
+// 匹配全部 job，结果按 video 1 帧号顺序写到各自的输出
+// 没有 -jobs 时 jobs[0] 已由 get_option 打开，结果同时写到标准输出
+// 出错的 job 跳过，全部成功时返回 true
+bool do_match(std::vector<vm_option::job> &jobs);
+
+// 以下为匹配内部的热点函数，供基准测试直接调用
+
+// 转为 GRAY8 并缩放到 new_width x new_height，附带预处理信息
+vm_frame::frame *_auto_pix_fmt_process(const vm_option::job &job,
+                                       AVFrame *frame);
 
-void do_match();
+// 按 -ssim 计算两帧的 SSIM，frame_num 只用于日志
+double compare_ssim(const vm_option::job &job, AVFrame *frame_1,
+                    AVFrame *frame_2, fnum frame_num);
 
 } // namespace vm_match
\ No newline at end of file
@@ -1,44 +1,518 @@
 #include "vm_option.hpp"
 
+#include <algorithm>
 #include <cstdlib>
+#include <filesystem>
 #include <format>
+#include <fstream>
+#include <thread>
 #include <vector>
 
+#include "vm_index.hpp"
 #include "vm_log.hpp"
+#include "vm_stats.hpp"
 #include "vm_utils.hpp"
 #include "vm_version.hpp"
+#include "vm_window.hpp"
 
 namespace vm_option {
 
 namespace param {
 
-std::string input_video_path_1, input_video_path_2, log_path;
-output_type_enum output_type = output_type_enum::framenum;
-double frame_scale = 1;
-double ssim_threshold = 0.992;
-int16_t frame_forward = 24;
+std::string index_path;
+std::string jobs_path;
+int concurrency = 0;
+std::string stats_path;
+std::string progress_path;
+int progress_interval = 1000;
+int threads = 1;
 bool benchmark = false, debug = false;
 std::string hwaccel("");
 
 } // namespace param
 
-int8_t video_stream_index_1 = -1, video_stream_index_2 = -1;
-AVFormatContext *formatContext_1 = nullptr, *formatContext_2 = nullptr;
-AVCodecContext *codecContext_1, *codecContext_2;
+std::vector<job> jobs;
+// args[0]，用于 -debug 输出的命令行
+std::string program_path;
 
-fnum frame_count_1, frame_count_2;
-uint32_t new_width, new_height;
-
-std::string _get_output_type_string() {
-  switch (param::output_type) {
+std::string _get_output_type_string(output_type_enum output_type) {
+  switch (output_type) {
   case output_type_enum::nooutput:
     return "nooutput";
   case output_type_enum::framenum:
     return "framenum";
+  case output_type_enum::ranges:
+    return "ranges";
+  case output_type_enum::json:
+    return "json";
+  case output_type_enum::binary:
+    return "binary";
+  case output_type_enum::timestamps:
+    return "timestamps";
+  }
+}
+
+std::string _get_ssim_mode_string(ssim_mode_enum ssim_mode) {
+  switch (ssim_mode) {
+  case ssim_mode_enum::native:
+    return "native";
+  case ssim_mode_enum::lavfi:
+    return "lavfi";
+  case ssim_mode_enum::check:
+    return "check";
+  }
+}
+
+std::string _get_decode_speed_string(decode_speed_enum decode_speed) {
+  switch (decode_speed) {
+  case decode_speed_enum::full:
+    return "full";
+  case decode_speed_enum::fast:
+    return "fast";
+  case decode_speed_enum::fastest:
+    return "fastest";
+  }
+}
+
+// 按 -decode-speed 降低解码精度，两个视频使用相同设置
+void _set_decode_speed(const job &job, AVCodecContext *codec_ctx,
+                       const AVCodec *codec) {
+  if (job.decode_speed == decode_speed_enum::full)
+    return;
+
+  // 解码器直接输出 1/2^n 尺寸，n 不超过 -scale，硬件解码不支持
+  if (param::hwaccel.empty()) {
+    int lowres = 0;
+    while (lowres < codec->max_lowres && (2 << lowres) <= job.frame_scale)
+      ++lowres;
+    codec_ctx->lowres = lowres;
+  }
+
+  codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+  // 非参考帧的误差不会传播
+  codec_ctx->skip_loop_filter = AVDISCARD_NONREF;
+
+  if (job.decode_speed == decode_speed_enum::fastest) {
+    codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+    codec_ctx->skip_idct = AVDISCARD_NONREF;
+  }
+}
+
+struct _video_info {
+  int width = 0, height = 0;
+  AVRational avg_frame_rate{0, 1};
+  int64_t nb_frames = 0;
+  fnum frame_count = 0;
+  bool have_frame_count = true;
+};
+
+// 打开输入视频并初始化解码器，num 为视频编号，用于提示信息
+_video_info _open_video(const job &job, int num, const std::string &path,
+                        AVFormatContext *&format_ctx,
+                        AVCodecContext *&codec_ctx, int8_t &stream_index) {
+  if (auto _res =
+          avformat_open_input(&format_ctx, path.c_str(), nullptr, nullptr);
+      _res != 0)
+    vm_log::errore(std::format("The video {0} \"{1}\" can not be opened: {2}",
+                               num, path, vm_utils::ff_err_to_str(_res)));
+
+  if (avformat_find_stream_info(format_ctx, nullptr) < 0) {
+    avformat_close_input(&format_ctx);
+    vm_log::errore(std::format(
+        "Unable to find stream information in video {0} \"{1}\"", num, path));
+  }
+
+  // 搜索第一个视频流
+  for (unsigned i = 0; i < format_ctx->nb_streams; ++i) {
+    if (format_ctx->streams[i]->codecpar->codec_type ==
+        AVMediaType::AVMEDIA_TYPE_VIDEO) {
+      stream_index = i;
+      break;
+    }
+  }
+  if (stream_index == -1) {
+    avformat_close_input(&format_ctx);
+    vm_log::errore(std::format(
+        "Unable to find any video stream in input file {0} \"{1}\"", num,
+        path));
+  }
+  AVStream *video_stream = format_ctx->streams[stream_index];
+
+  // 获取视频流的解码器上下文
+  AVCodecParameters *codec_params = video_stream->codecpar;
+  const AVCodec *codec = avcodec_find_decoder(codec_params->codec_id);
+  if (!codec) {
+    avformat_close_input(&format_ctx);
+    vm_log::errore(
+        std::format("Failed to find codec in video {0} \"{1}\"", num, path));
+  }
+  codec_ctx = avcodec_alloc_context3(codec);
+  if (!codec_ctx) {
+    avformat_close_input(&format_ctx);
+    vm_log::errore(std::format(
+        "Failed to allocate video codec context in video {0} \"{1}\"", num,
+        path));
+  }
+  if (avcodec_parameters_to_context(codec_ctx, codec_params) < 0) {
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&format_ctx);
+    vm_log::errore(std::format("Failed to copy codec parameters to decoder "
+                               "context in video {0} \"{1}\"",
+                               num, path));
+  }
+
+  // 设置多线程解码
+  if (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS ||
+      codec->capabilities & AV_CODEC_CAP_SLICE_THREADS) {
+    codec_ctx->thread_type = FF_THREAD_FRAME;
+    codec_ctx->thread_count = job.decode_threads;
+  }
+
+  // 设置硬件加速，所有视频共用一个设备，-jobs 时可能在多个线程中同时打开
+  if (param::hwaccel != "") {
+    static AVBufferRef *hw_device_ctx = [] {
+      AVBufferRef *device_ctx = nullptr;
+      AVHWDeviceType hw_type =
+          av_hwdevice_find_type_by_name(param::hwaccel.c_str());
+      if (hw_type == AV_HWDEVICE_TYPE_NONE)
+        vm_log::error(std::format("Unable to find the hwaccel type: {0}",
+                                  param::hwaccel));
+
+      if ((av_hwdevice_ctx_create(&device_ctx, hw_type, NULL, NULL, 0)) != 0)
+        vm_log::error("Failed to create hardware device context");
+      return device_ctx;
+    }();
+
+    codec_ctx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
+    if (!codec_ctx->hw_device_ctx)
+      vm_log::error(std::format(
+          "Failed to create reference to hardware context in video {0}", num));
+  }
+
+  _set_decode_speed(job, codec_ctx, codec);
+
+  // 打开
+  if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&format_ctx);
+    vm_log::errore(
+        std::format("Failed to open codec in video {0} \"{1}\"", num, path));
+  }
+
+  _video_info info;
+  info.width = codec_params->width;
+  info.height = codec_params->height;
+  info.avg_frame_rate = video_stream->avg_frame_rate;
+  info.nb_frames = video_stream->nb_frames;
+
+  // 猜测帧数
+  AVRational r_frame_rate =
+      av_guess_frame_rate(format_ctx, video_stream, nullptr);
+  if (av_cmp_q(r_frame_rate, video_stream->avg_frame_rate))
+    info.have_frame_count = false;
+  else
+    info.frame_count = static_cast<fnum>(
+        round(static_cast<double>(format_ctx->duration) / AV_TIME_BASE *
+              av_q2d(video_stream->avg_frame_rate)));
+
+  return info;
+}
+
+void open_video(const job &job, int num, const std::string &path,
+                AVFormatContext *&format_ctx, AVCodecContext *&codec_ctx,
+                int8_t &stream_index) {
+  _open_video(job, num, path, format_ctx, codec_ctx, stream_index);
+}
+
+// 索引代替 video 2，帧数为精确值
+_video_info _check_index(const video_2 &video, const vm_index::reader &index) {
+  const vm_index::header &head = index.info();
+
+  // 源文件变化时索引可能已过期
+  std::error_code ec;
+  std::filesystem::path source = vm_utils::utf8_to_path(head.source_path);
+  if (std::filesystem::exists(source, ec) &&
+      (std::filesystem::file_size(source, ec) != head.source_size ||
+       std::filesystem::last_write_time(source, ec)
+               .time_since_epoch()
+               .count() != head.source_mtime))
+    vm_log::warning(std::format(
+        "The source \"{0}\" of index \"{1}\" has changed since indexing",
+        head.source_path, video.input_video_path));
+
+  _video_info info;
+  info.width = head.source_width;
+  info.height = head.source_height;
+  info.avg_frame_rate = {head.frame_rate_num, head.frame_rate_den};
+  info.nb_frames = head.frame_count;
+  info.frame_count = head.frame_count;
+  return info;
+}
+
+// 解析一个 job 的参数，未给出的保持原值
+// -i2 与 -log 可重复，给出时按顺序替换原有的
+void _parse_job(std::vector<std::string> &args, job &job) {
+  std::vector<std::string> inputs_2, logs;
+  args.push_back("");
+  for (size_t i = 0; i + 1 < args.size(); ++i) {
+    if (args[i] == "-i1" || args[i] == "-input1")
+      job.input_video_path_1 = args[i + 1];
+    if (args[i] == "-i2" || args[i] == "-input2")
+      inputs_2.push_back(args[i + 1]);
+    if (args[i] == "-t" || args[i] == "-type") {
+      if (args[i + 1] == "nooutput")
+        job.output_type = output_type_enum::nooutput;
+      if (args[i + 1] == "framenum")
+        job.output_type = output_type_enum::framenum;
+      if (args[i + 1] == "ranges")
+        job.output_type = output_type_enum::ranges;
+      if (args[i + 1] == "json")
+        job.output_type = output_type_enum::json;
+      if (args[i + 1] == "binary")
+        job.output_type = output_type_enum::binary;
+      if (args[i + 1] == "timestamps")
+        job.output_type = output_type_enum::timestamps;
+    }
+    if (args[i] == "-log")
+      logs.push_back(args[i + 1]);
+    if (args[i] == "-th" || args[i] == "-threshold")
+      job.ssim_threshold = std::stod(args[i + 1]);
+    if (args[i] == "-ssim") {
+      if (args[i + 1] == "native")
+        job.ssim_mode = ssim_mode_enum::native;
+      if (args[i + 1] == "lavfi")
+        job.ssim_mode = ssim_mode_enum::lavfi;
+      if (args[i + 1] == "check")
+        job.ssim_mode = ssim_mode_enum::check;
+    }
+    if (args[i] == "-scale")
+      job.frame_scale = std::stod(args[i + 1]);
+    if (args[i] == "-forward")
+      job.frame_forward = std::stoi(args[i + 1]);
+    if (args[i] == "-forward-min")
+      job.forward_min = std::stoi(args[i + 1]);
+    if (args[i] == "-forward-max")
+      job.forward_max = std::stoi(args[i + 1]);
+    if (args[i] == "-window-memory")
+      job.window_memory = std::stoi(args[i + 1]);
+    if (args[i] == "-noprefilter")
+      job.prefilter = false;
+    if (args[i] == "-nohash")
+      job.hash = false;
+    if (args[i] == "-pyramid")
+      job.pyramid = std::stoi(args[i + 1]);
+    if (args[i] == "-resync")
+      job.resync = std::stoi(args[i + 1]);
+    if (args[i] == "-pts")
+      job.pts = true;
+    if (args[i] == "-segments")
+      job.segments = std::stoi(args[i + 1]);
+    if (args[i] == "-packet")
+      job.packet = true;
+    if (args[i] == "-decode-speed") {
+      if (args[i + 1] == "full")
+        job.decode_speed = decode_speed_enum::full;
+      if (args[i + 1] == "fast")
+        job.decode_speed = decode_speed_enum::fast;
+      if (args[i + 1] == "fastest")
+        job.decode_speed = decode_speed_enum::fastest;
+    }
+  }
+  args.pop_back();
+
+  if (!inputs_2.empty())
+    job.videos_2.resize(inputs_2.size());
+  if (job.videos_2.size() < logs.size())
+    job.videos_2.resize(logs.size());
+  for (size_t k = 0; k < inputs_2.size(); ++k)
+    job.videos_2[k].input_video_path = inputs_2[k];
+  for (size_t k = 0; k < logs.size(); ++k)
+    job.videos_2[k].log_path = logs[k];
+}
+
+// 按空白切分 -jobs 文件的一行，双引号内的空白不切分
+std::vector<std::string> _split_line(const std::string &line) {
+  std::vector<std::string> result;
+  std::string token;
+  bool quoted = false, have_token = false;
+  for (char c : line) {
+    if (c == '"') {
+      quoted = !quoted;
+      have_token = true;
+    } else if (!quoted && (c == ' ' || c == '\t' || c == '\r')) {
+      if (have_token)
+        result.push_back(std::move(token));
+      token.clear();
+      have_token = false;
+    } else {
+      token += c;
+      have_token = true;
+    }
+  }
+  if (have_token)
+    result.push_back(std::move(token));
+  return result;
+}
+
+// 读取 -jobs 文件，每行在 defaults 的基础上覆盖参数
+std::vector<job> _read_jobs(const std::string &path, const job &defaults) {
+  std::ifstream file(vm_utils::utf8_to_path(path));
+  if (!file.is_open())
+    vm_log::errore(std::format("Unable to open the job file \"{0}\"", path));
+
+  std::vector<job> result;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::vector<std::string> args = _split_line(line);
+    if (args.empty() || args[0].starts_with('#'))
+      continue;
+    result.push_back(defaults);
+    try {
+      vm_log::job_scope scope;
+      _parse_job(args, result.back());
+    } catch (const vm_log::job_error &) {
+      result.back().failed = true;
+    }
+  }
+  if (result.empty())
+    vm_log::errore(std::format("The job file \"{0}\" has no jobs", path));
+  return result;
+}
+
+// 不需要打开视频的参数校验，name 用于提示信息
+void _check_job(job &job, const std::string &name) {
+  if (param::index_path.empty() && job.input_video_path_1.empty())
+    vm_log::errore(std::format("Need input video 1 (-i1){0}", name));
+  if (job.videos_2.empty())
+    vm_log::errore(std::format("Need input video 2 (-i2){0}", name));
+  if (job.videos_2.size() > 1 && !param::index_path.empty())
+    vm_log::errore("-mkindex needs exactly one input video 2 (-i2)");
+
+  for (const video_2 &video : job.videos_2) {
+    if (video.input_video_path.empty())
+      vm_log::errore(
+          std::format("More -log than input video 2 (-i2){0}", name));
+
+    if (job.output_type == output_type_enum::binary &&
+        video.log_path.empty() && param::index_path.empty())
+      vm_log::errore(
+          std::format("-type binary needs a log file (-log){0}", name));
+    // 多个 job 或多个 video 2 的结果不能同时写到标准输出
+    if ((!param::jobs_path.empty() || job.videos_2.size() > 1) &&
+        video.log_path.empty() &&
+        job.output_type != output_type_enum::nooutput)
+      vm_log::errore(std::format(
+          "Need a log file (-log) for each input video 2 (-i2){0}", name));
+  }
+
+  if (job.ssim_threshold < 0 || job.ssim_threshold > 1)
+    vm_log::errore(
+        std::format("-th {0} out of range{1}", job.ssim_threshold, name));
+
+  if (job.frame_scale <= 0)
+    vm_log::errore(
+        std::format("-scale {0} out of range{1}", job.frame_scale, name));
+
+  if (job.frame_forward <= 0 || job.frame_forward == 32767)
+    vm_log::errore(
+        std::format("-forward {0} out of range{1}", job.frame_forward, name));
+
+  // 只给出一端时，另一端取 -forward
+  if (!job.forward_min)
+    job.forward_min = job.forward_max
+                          ? std::min(job.frame_forward, job.forward_max)
+                          : job.frame_forward;
+  if (!job.forward_max)
+    job.forward_max = std::max(job.frame_forward, job.forward_min);
+  if (job.forward_min < 1 || job.forward_min > job.forward_max ||
+      job.forward_max == 32767)
+    vm_log::errore(std::format("-forward-min {0} -forward-max {1} out of "
+                               "range{2}",
+                               job.forward_min, job.forward_max, name));
+  job.frame_forward =
+      std::clamp(job.frame_forward, job.forward_min, job.forward_max);
+
+  if (job.window_memory < 0)
+    vm_log::errore(std::format("-window-memory {0} out of range{1}",
+                               job.window_memory, name));
+
+  if (job.pyramid < 0)
+    vm_log::errore(std::format("-pyramid {0} out of range{1}", job.pyramid,
+                               name));
+
+  if (job.segments < 1)
+    vm_log::errore(std::format("-segments {0} out of range{1}", job.segments,
+                               name));
+
+  if (job.resync < 0)
+    vm_log::errore(
+        std::format("-resync {0} out of range{1}", job.resync, name));
+
+  // 时间取自时间线
+  if (job.output_type == output_type_enum::timestamps)
+    job.pts = true;
+
+  // 跳转后的状态无法由分段的预热重现
+  if (job.segments > 1 && job.resync) {
+    vm_log::warning(std::format(
+        "-segments can not be used with -resync, set to 1{0}", name));
+    job.segments = 1;
+  }
+
+  // 分段的预热按固定窗口顺序匹配，不使用时间戳预测
+  if (job.segments > 1 && job.pts) {
+    vm_log::warning(std::format("-segments can not be used with -pts or "
+                                "-type timestamps, set to 1{0}",
+                                name));
+    job.segments = 1;
+  }
+
+  // 自适应窗口的大小无法由分段的预热重现
+  if (job.segments > 1 && job.forward_min != job.forward_max) {
+    vm_log::warning(std::format(
+        "-segments can not be used with -forward-min/-forward-max, set to "
+        "1{0}",
+        name));
+    job.segments = 1;
+  }
+
+  // 分段时每段各自解码 video 1，与共用 video 1 的解码相抵
+  if (job.segments > 1 && job.videos_2.size() > 1) {
+    vm_log::warning(std::format(
+        "-segments can not be used with several -i2, set to 1{0}", name));
+    job.segments = 1;
+  }
+
+  // 对齐结果按一对视频写出
+  if (job.packet && job.videos_2.size() > 1) {
+    vm_log::warning(std::format(
+        "-packet can not be used with several -i2, disabled{0}", name));
+    job.packet = false;
+  }
+
+  // lavfi 滤镜图只有一个，不能同时用于多个 job 或线程
+  if (job.ssim_mode != ssim_mode_enum::native && param::concurrency > 1) {
+    vm_log::warning(std::format("The lavfi SSIM filter graph is not thread "
+                                "safe, -ssim is set to native{0}",
+                                name));
+    job.ssim_mode = ssim_mode_enum::native;
+  }
+
+  if (param::threads > 1 && job.ssim_mode != ssim_mode_enum::native) {
+    vm_log::warning("The lavfi SSIM filter graph is not thread safe, "
+                    "-threads is set to 1");
+    param::threads = 1;
+  }
+
+  if (job.segments > 1 && job.ssim_mode != ssim_mode_enum::native) {
+    vm_log::warning("The lavfi SSIM filter graph is not thread safe, "
+                    "-segments is set to 1");
+    job.segments = 1;
   }
 }
 
 void get_option(std::vector<std::string> &args) {
+  job defaults;
   std::string version_info =
       std::format("{0}\nVersion: {1}\n{2}\nFFmpeg: {3}", PROGRAM_NAME, VERSION,
                   HOME_LINK, av_version_info());
@@ -64,39 +538,178 @@ Input options:
 
     -i2 / -input2 <string>
         Input the path of the second video
+        An index file built by -mkindex can be used instead of the video
+        Can be given several times to match the first video against each of
+        them in one pass, decoding the first video only once
+        Messages number them as video 2, 3, ...
+
+Batch options:
+    -jobs <string>
+        Match the pairs of videos listed in this file, one job per line, e.g.
+        -i1 "a 1.mp4" -i2 b1.mp4 -log a1.txt -th 0.99
+        Input, output, filter and accuracy options given on the command line
+        are the defaults of every job
+        Each job needs -log unless its -type is nooutput
+        Empty lines and lines starting with # are ignored
+
+    -concurrency <int>
+        Number of jobs matched at the same time with -jobs, sharing the
+        -threads comparison threads
+        0 means -threads / 3
+        Default: {13}
 
 Output options:
     -t / -type <string>
         Set the output type
         Nooutput: no output
         Framenum: output the number of matching frames
+        Ranges: merge frames with a constant offset into one line,
+        e.g. "0-43199 -> 12-43211", unmatched runs map to -1
+        Json: the same ranges as a JSON array
+        Binary: one little-endian int32 per frame, -1 for no match, only
+        written to the log file
+        Timestamps: like framenum with the time in seconds after each frame
+        number, e.g. "12 0.500000->15 0.625000", implies -pts
         Default: "{1}"
 
     -log <string>
         Set the path of log file
-        Required that -type is not nooutput
+        Uses the -type format, or framenum when -type is nooutput
         If it is empty, no output file
+        With several -i2, give one -log for each, in the same order, and the
+        results are not written to stdout
         Default: "{2}"
 
+    -mkindex <string>
+        Decode the second video (-i2) and write its index to this path, then
+        exit
+        The index must be used with the same -scale and -decode-speed
+
 Filter options:
     -th / -threshold <float 0..1.0>
         Set the ssim_threshold value
         Default: {3}
 
+    -ssim <string>
+        Set the SSIM implementation
+        Native: built-in SIMD implementation
+        Lavfi: libavfilter ssim filter graph
+        Check: compute both and warn when they differ
+        Default: "{6}"
+
+    -noprefilter
+        Disable the signature prefilter that skips candidates whose SSIM
+        upper bound is below the threshold
+
+    -nohash
+        Disable the exact duplicate fast path that accepts a candidate whose
+        preprocessed frame is bit-identical to the video 1 frame without SSIM
+
+    -pyramid <int>
+        Rank candidates by SSIM at 1/{9} of the comparison size and verify only
+        the best ones at full size first
+        Candidates ranked lower but probed earlier are still verified, so the
+        result is the same as without -pyramid
+        0 means disabled
+        Default: {8}
+
 Accuracy options:
     -scale <float>
         Scaling images for comparison
         e.g. -scale 2 == 0.5x
+        Integer values use a fast box filter on the luma plane
         Default: {4}
 
     -forward <int 1..32766>
         Maximum additional frames to compare if no matching frames can be found
+        With -forward-min or -forward-max, the starting value
         Default: {5}
 
+    -forward-min <int 1..32766>
+    -forward-max <int 1..32766>
+        Let -forward adapt between these values: it halves after a long run of
+        matches at a constant offset and doubles after repeated misses
+        The window holds up to 3 * -forward-max + 1 frames
+        Each one not given is the same as -forward, so the window is fixed by
+        default
+        -debug prints every change
+
+    -pts
+        Align by timestamps for VFR videos: read the PTS of every frame first,
+        take exact frame counts from them, predict each frame of the second
+        video from the time of the frame of the first video plus the time
+        offset of the last match, and seek instead of decoding through large
+        gaps
+        An index used as the second video is taken as CFR
+
+    -resync <int>
+        After this many consecutive unmatched frames, wait for the next scene
+        cut of the first video and jump to the scene cut of the second video
+        with the most similar signature that also passes the SSIM threshold,
+        then continue matching from there
+        Recovers from insertions or deletions longer than -forward, e.g. ad
+        breaks, without a large -forward
+        Scene cuts of the second video are indexed as it is decoded, reading
+        ahead up to {14} frames per jump
+        The second video needs valid PTS unless it is an index
+        0 means disabled
+        Default: {15}
+
+    -window-memory <int>
+        Limit each window to this many MiB by lowering -forward-max
+        0 means no limit
+        Default: 0
+
 Performance options:
     -benchmark
         Output running time (ms)
 
+    -stats <string>
+        Write per-stage time, call counts, comparison counters, the probe
+        position of matches and the peak window size to this path as JSON
+        when matching ends
+
+    -progress <string>
+        Write a progress record as one line of JSON to this path every
+        -progress-interval: frames done, fps, ETA, SSIM comparisons per
+        second and window fill, and a last record with "done": true
+        "fd:N" writes to file descriptor N, e.g. fd:2 for stderr
+
+    -progress-interval <int>
+        Milliseconds between progress records
+        Default: {12}
+
+    -threads <int>
+        Number of threads used to compare candidate frames
+        0 means the number of logical CPUs
+        Default: {7}
+
+    -segments <int>
+        Split the first video into this many keyframe-aligned segments and
+        match them in parallel, each with its own decoders
+        The result is the same as matching in one pass
+        Default: {10}
+
+    -packet
+        Hash the compressed packets of both videos first and match frames
+        whose packets are identical from a common keyframe on, e.g. remuxes
+        or copies trimmed at keyframes, without decoding them
+        The remaining frames are decoded from the nearest keyframe and
+        matched by SSIM, starting from the offset of the preceding match
+        Needs the same codec parameters and valid PTS in both videos, and
+        only one second video that is not an index
+
+    -decode-speed <string>
+        Trade decoding accuracy for speed
+        Full: decode every pixel exactly
+        Fast: decode at 1/2, 1/4 or 1/8 size when -scale allows and the
+        codec supports it (lowres), use fast decoder flags and skip the loop
+        filter on non-reference frames
+        Fastest: also skip the loop filter on all frames and the IDCT on
+        non-reference frames, errors spread until the next keyframe
+        Compare with full decoding before relying on a faster mode
+        Default: "{11}"
+
     -hw / -hwaccel <string>
         Select the hardware acceleration
 
@@ -105,288 +718,345 @@ Debug options:
         Output debug messages on the command line
         Will not be terminated when certain errors occurs
 )",
-          version_info, _get_output_type_string(), param::log_path,
-          param::ssim_threshold, param::frame_scale, param::frame_forward));
+          version_info, _get_output_type_string(defaults.output_type),
+          "", defaults.ssim_threshold, defaults.frame_scale,
+          defaults.frame_forward, _get_ssim_mode_string(defaults.ssim_mode),
+          param::threads, defaults.pyramid, pyramid_factor, defaults.segments,
+          _get_decode_speed_string(defaults.decode_speed),
+          param::progress_interval, param::concurrency, resync_lookahead,
+          defaults.resync));
 
       std::exit(EXIT_SUCCESS);
     }
   }
 
+  // 进程参数
+  program_path = args[0];
   args.push_back("");
-  for (int i = 0; i < args.size(); ++i) {
-    if (args[i] == "-i1" || args[i] == "-input1")
-      param::input_video_path_1 = args[i + 1];
-    if (args[i] == "-i2" || args[i] == "-input2")
-      param::input_video_path_2 = args[i + 1];
-    if (args[i] == "-t" || args[i] == "-type") {
-      if (args[i + 1] == "nooutput")
-        param::output_type = output_type_enum::nooutput;
-      if (args[i + 1] == "framenum")
-        param::output_type = output_type_enum::framenum;
-    }
-    if (args[i] == "-log")
-      param::log_path = args[i + 1];
-    if (args[i] == "-th" || args[i] == "-threshold")
-      param::ssim_threshold = std::stod(args[i + 1]);
-    if (args[i] == "-scale")
-      param::frame_scale = std::stod(args[i + 1]);
-    if (args[i] == "-forward")
-      param::frame_forward = std::stoi(args[i + 1]);
+  for (size_t i = 0; i + 1 < args.size(); ++i) {
+    if (args[i] == "-mkindex")
+      param::index_path = args[i + 1];
+    if (args[i] == "-jobs")
+      param::jobs_path = args[i + 1];
+    if (args[i] == "-concurrency")
+      param::concurrency = std::stoi(args[i + 1]);
+    if (args[i] == "-threads")
+      param::threads = std::stoi(args[i + 1]);
     if (args[i] == "-benchmark")
       param::benchmark = true;
+    if (args[i] == "-stats")
+      param::stats_path = args[i + 1];
+    if (args[i] == "-progress")
+      param::progress_path = args[i + 1];
+    if (args[i] == "-progress-interval")
+      param::progress_interval = std::stoi(args[i + 1]);
     if (args[i] == "-hw" || args[i] == "-hwaccel")
       param::hwaccel = args[i + 1];
     if (args[i] == "-debug")
       param::debug = true;
   }
+  args.pop_back();
 
-  // 视频校验
-  if (param::input_video_path_1.empty())
-    vm_log::errore("Need input video 1 (-i1)");
-  if (param::input_video_path_2.empty())
-    vm_log::errore("Need input video 2 (-i2)");
-
-  // 输入
-  if (auto _res = avformat_open_input(&formatContext_1,
-                                      param::input_video_path_1.c_str(),
-                                      nullptr, nullptr);
-      _res != 0)
-    vm_log::errore("The video 1 \"" + param::input_video_path_1 +
-                   "\" can not be opened: " + vm_utils::ff_err_to_str(_res));
+  // 只有写出报告时才计时
+  vm_stats::enabled = !param::stats_path.empty();
 
-  if (auto _res = avformat_open_input(&formatContext_2,
-                                      param::input_video_path_2.c_str(),
-                                      nullptr, nullptr);
-      _res != 0)
-    vm_log::errore("The video 2 \"" + param::input_video_path_2 +
-                   "\" can not be opened: " + vm_utils::ff_err_to_str(_res));
+  if (param::threads < 0)
+    vm_log::errore(std::format("-threads {} out of range", param::threads));
+  if (param::threads == 0)
+    param::threads =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
 
-  if (avformat_find_stream_info(formatContext_1, nullptr) < 0) {
-    avformat_close_input(&formatContext_1);
-    vm_log::errore("Unable to find stream information in video 1 \"" +
-                   param::input_video_path_1 + "\"");
-  }
+  if (param::progress_interval <= 0)
+    vm_log::errore(std::format("-progress-interval {} out of range",
+                               param::progress_interval));
 
-  if (avformat_find_stream_info(formatContext_2, nullptr) < 0) {
-    avformat_close_input(&formatContext_2);
-    vm_log::errore("Unable to find stream information in video 2 \"" +
-                   param::input_video_path_2 + "\"");
-  }
+  if (param::concurrency < 0)
+    vm_log::errore(
+        std::format("-concurrency {} out of range", param::concurrency));
+  // 每个 job 至少有两个解码线程与一个匹配线程
+  if (param::concurrency == 0)
+    param::concurrency = std::max(1, param::threads / 3);
 
-  // 搜索第一个视频流
-  for (unsigned i = 0; i < formatContext_1->nb_streams; ++i) {
-    if (formatContext_1->streams[i]->codecpar->codec_type ==
-        AVMediaType::AVMEDIA_TYPE_VIDEO) {
-      video_stream_index_1 = i;
-      break;
-    }
-  }
-  if (video_stream_index_1 == -1) {
-    avformat_close_input(&formatContext_1);
-    vm_log::errore("Unable to find any video stream in input file 1 \"" +
-                   param::input_video_path_1 + "\"");
+  // 每对视频的参数，命令行中的为默认值
+  _parse_job(args, defaults);
+
+  if (param::jobs_path.empty()) {
+    param::concurrency = 1;
+    jobs.assign(1, defaults);
+    _check_job(jobs[0], "");
+    open(jobs[0]);
+    return;
   }
-  AVStream *videoStream_1 = formatContext_1->streams[video_stream_index_1];
 
-  for (unsigned i = 0; i < formatContext_2->nb_streams; ++i) {
-    if (formatContext_2->streams[i]->codecpar->codec_type ==
-        AVMediaType::AVMEDIA_TYPE_VIDEO) {
-      video_stream_index_2 = i;
-      break;
+  if (!param::index_path.empty())
+    vm_log::errore("-mkindex can not be used with -jobs");
+  jobs = _read_jobs(param::jobs_path, defaults);
+  param::concurrency =
+      std::min(param::concurrency, static_cast<int>(jobs.size()));
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    try {
+      vm_log::job_scope scope;
+      if (!jobs[i].failed)
+        _check_job(jobs[i], std::format(" in job {0}", i + 1));
+    } catch (const vm_log::job_error &) {
+      jobs[i].failed = true;
     }
+    // 解码线程按同时运行的 job 平分 -threads
+    jobs[i].decode_threads =
+        std::max(1, param::threads / (2 * param::concurrency));
   }
-  if (video_stream_index_2 == -1) {
-    avformat_close_input(&formatContext_2);
-    vm_log::errore("Unable to find any video stream in input file 2 \"" +
-                   param::input_video_path_2 + "\"");
-  }
-  AVStream *videoStream_2 = formatContext_2->streams[video_stream_index_2];
+}
+
+// 打开 video 2 并与 video 1 对照，num 为视频编号
+_video_info _open_video_2(job &job, video_2 &video, int num,
+                   const _video_info &info_1) {
+  _video_info info_2;
+  if (vm_index::is_index(video.input_video_path)) {
+    video.index = new vm_index::reader(video.input_video_path);
+    info_2 = _check_index(video, *video.index);
+  } else
+    info_2 = _open_video(job, num, video.input_video_path,
+                         video.formatContext, video.codecContext,
+                         video.video_stream_index);
+
+  if (!info_2.have_frame_count)
+    vm_log::warning(std::format("The video {0} is VFR", num));
+
+  // 建立索引只需要 video 2
+  const _video_info &info = param::index_path.empty() ? info_1 : info_2;
+
+  // 提示信息中的视频对
+  std::string pair = job.videos_2.size() == 1
+                         ? "The two videos"
+                         : std::format("The video 1 and video {0}", num);
 
   // 校验宽高
-  if (videoStream_1->codecpar->width != videoStream_2->codecpar->width ||
-      videoStream_1->codecpar->height != videoStream_2->codecpar->height)
+  if (info.width != info_2.width || info.height != info_2.height)
     vm_log::errore(std::format(
-        "The two videos have different widths or heights: {0}x{1} {2}x{3}",
-        videoStream_1->codecpar->width, videoStream_1->codecpar->height,
-        videoStream_2->codecpar->width, videoStream_2->codecpar->height));
+        "{0} have different widths or heights: {1}x{2} {3}x{4}", pair,
+        info.width, info.height, info_2.width, info_2.height));
 
-  // 获取视频流的解码器上下文
-  AVCodecParameters *codecParams_1 = videoStream_1->codecpar;
-  const AVCodec *codec_1 = avcodec_find_decoder(codecParams_1->codec_id);
-  if (!codec_1) {
-    avformat_close_input(&formatContext_1);
-    vm_log::errore("Failed to find codec in video 1 \"" +
-                   param::input_video_path_1 + "\"");
-  }
-  codecContext_1 = avcodec_alloc_context3(codec_1);
-  if (!codecContext_1) {
-    avformat_close_input(&formatContext_1);
-    vm_log::errore("Failed to allocate video codec context in video 1 \"" +
-                   param::input_video_path_1 + "\"");
-  }
-  if (avcodec_parameters_to_context(codecContext_1, codecParams_1) < 0) {
-    avcodec_free_context(&codecContext_1);
-    avformat_close_input(&formatContext_1);
-    vm_log::errore(
-        "Failed to copy codec parameters to decoder context in video 1 \"" +
-        param::input_video_path_1 + "\"");
-  }
-
-  AVCodecParameters *codecParams_2 = videoStream_2->codecpar;
-  const AVCodec *codec_2 = avcodec_find_decoder(codecParams_2->codec_id);
-  if (!codec_2) {
-    avformat_close_input(&formatContext_2);
-    vm_log::errore("Failed to find codec in video 2 \"" +
-                   param::input_video_path_2 + "\"");
-  }
-  codecContext_2 = avcodec_alloc_context3(codec_2);
-  if (!codecContext_2) {
-    avformat_close_input(&formatContext_2);
-    vm_log::errore("Failed to allocate video codec context in video 2 \"" +
-                   param::input_video_path_2 + "\"");
-  }
-  if (avcodec_parameters_to_context(codecContext_2, codecParams_2) < 0) {
-    avcodec_free_context(&codecContext_2);
-    avformat_close_input(&formatContext_2);
-    vm_log::errore(
-        "Failed to copy codec parameters to decoder context in video 2 \"" +
-        param::input_video_path_2 + "\"");
-  }
+  // 猜测帧数
+  if (!info.have_frame_count || !info_2.have_frame_count)
+    vm_log::warning(
+        "VFR video exists, frame rate guesses may not be accurate (Incorrect "
+        "muxing may cause a program to mistake CFR video for VFR)");
+  video.frame_count = info_2.frame_count;
+  video.frame_rate = info_2.avg_frame_rate;
+  if (param::debug)
+    vm_log::info(std::format("{0} frame counts: Metadata: {1} F & {2} F; "
+                             "Guess: {3} F & {4} F",
+                             pair, info.nb_frames, info_2.nb_frames,
+                             info.frame_count, video.frame_count));
 
-  // 设置多线程解码
-  if (codec_1->capabilities & AV_CODEC_CAP_FRAME_THREADS ||
-      codec_1->capabilities & AV_CODEC_CAP_SLICE_THREADS) {
-    codecContext_1->thread_type = FF_THREAD_FRAME;
-    codecContext_1->thread_count = 0;
-  }
-  if (codec_2->capabilities & AV_CODEC_CAP_FRAME_THREADS ||
-      codec_2->capabilities & AV_CODEC_CAP_SLICE_THREADS) {
-    codecContext_2->thread_type = FF_THREAD_FRAME;
-    codecContext_2->thread_count = 0;
-  }
+  if (info.nb_frames && info_2.nb_frames &&
+      (info.frame_count != info.nb_frames ||
+       video.frame_count != info_2.nb_frames))
+    vm_log::warning(std::format(
+        "{0} have different frame counts between metadata and guess: "
+        "Metadata: {1} F & {2} F; Guess: {3} F & {4} F",
+        pair, info.nb_frames, info_2.nb_frames, info.frame_count,
+        video.frame_count));
 
-  // 设置硬件加速
-  if (param::hwaccel != "") {
-    AVHWDeviceType hw_type =
-        av_hwdevice_find_type_by_name(param::hwaccel.c_str());
-    if (hw_type == AV_HWDEVICE_TYPE_NONE)
-      vm_log::error(
-          std::format("Unable to find the hwaccel type: {0}", param::hwaccel));
+  if (info.frame_count != video.frame_count)
+    vm_log::warning(
+        std::format("{0} have different frame counts: {1} F & {2} F", pair,
+                    info.frame_count, video.frame_count));
 
-    AVBufferRef *hw_device_ctx = nullptr;
-    if ((av_hwdevice_ctx_create(&hw_device_ctx, hw_type, NULL, NULL, 0)) != 0)
-      vm_log::error("Failed to create hardware device context");
+  if (param::debug)
+    vm_log::info(std::format(
+        "{0} FPS: {1}/{2} FPS & {3}/{4} FPS", pair, info.avg_frame_rate.num,
+        info.avg_frame_rate.den, info_2.avg_frame_rate.num,
+        info_2.avg_frame_rate.den));
 
-    codecContext_1->hw_device_ctx = av_buffer_ref(hw_device_ctx);
-    if (!codecContext_1->hw_device_ctx)
-      vm_log::error(
-          "Failed to create reference to hardware context in video 1");
+  if (av_cmp_q(info.avg_frame_rate, info_2.avg_frame_rate))
+    vm_log::warning(std::format(
+        "{0} have different FPS: {1}/{2} FPS & {3}/{4} FPS", pair,
+        info.avg_frame_rate.num, info.avg_frame_rate.den,
+        info_2.avg_frame_rate.num, info_2.avg_frame_rate.den));
+  return info_2;
+}
 
-    codecContext_2->hw_device_ctx = av_buffer_ref(hw_device_ctx);
-    if (!codecContext_2->hw_device_ctx)
-      vm_log::error(
-          "Failed to create reference to hardware context in video 2");
+// -pts 与 -resync 的时间线，帧数改为时间线给出的准确值
+// PTS 无效时 -pts 关闭，该 video 2 的 -resync 也随之关闭
+void _scan_timelines(job &job) {
+  if (job.pts && !vm_segment::scan(job.input_video_path_1,
+                                   job.video_stream_index_1, job.timeline_1)) {
+    if (job.output_type == output_type_enum::timestamps)
+      vm_log::errore("-type timestamps needs valid PTS in video 1");
+    vm_log::warning("Missing or duplicate PTS in video 1, -pts is disabled");
+    job.pts = false;
   }
+  if (job.pts)
+    job.frame_count_1 = job.timeline_1.size();
+
+  for (size_t k = 0; k < job.videos_2.size(); ++k) {
+    video_2 &video = job.videos_2[k];
+    if (video.index) {
+      // 索引中没有 PTS，按帧率生成
+      if (job.pts) {
+        video.timeline.pts.resize(video.frame_count);
+        for (fnum i = 0; i < video.frame_count; ++i)
+          video.timeline.pts[i] = i;
+        video.timeline.time_base = av_inv_q(video.frame_rate);
+      }
+      continue;
+    }
+    if (!job.pts && !job.resync)
+      continue;
 
-  // 打开1
-  if (avcodec_open2(codecContext_1, codec_1, nullptr) < 0) {
-    avcodec_free_context(&codecContext_1);
-    avformat_close_input(&formatContext_1);
-    vm_log::errore("Failed to open codec in video 1 \"" +
-                   param::input_video_path_1 + "\"");
+    if (vm_segment::scan(video.input_video_path, video.video_stream_index,
+                         video.timeline))
+      video.frame_count = video.timeline.size();
+    else {
+      if (job.output_type == output_type_enum::timestamps)
+        vm_log::errore(std::format(
+            "-type timestamps needs valid PTS in video {0}", k + 2));
+      vm_log::warning(std::format(
+          "Missing or duplicate PTS in video {0}, -pts and -resync are "
+          "disabled for it",
+          k + 2));
+      video.timeline = {};
+      job.pts = false;
+    }
   }
 
-  // 打开2
-  if (avcodec_open2(codecContext_2, codec_2, nullptr) < 0) {
-    avcodec_free_context(&codecContext_2);
-    avformat_close_input(&formatContext_2);
-    vm_log::errore("Failed to open codec in video 2 \"" +
-                   param::input_video_path_2 + "\"");
+  if (param::debug && job.pts) {
+    std::string counts;
+    for (const video_2 &video : job.videos_2)
+      counts += std::format(" & {0} F", video.frame_count);
+    vm_log::info(std::format("Frame counts from PTS: {0} F{1}",
+                             job.frame_count_1, counts));
   }
+}
 
-  // 参数校验
-  if (param::ssim_threshold < 0 || param::ssim_threshold > 1)
-    vm_log::errore(
-        std::format("-scale {} out of range", param::ssim_threshold));
+void open(job &job) {
+  // 视频校验
+  if (!param::index_path.empty() &&
+      vm_index::is_index(job.videos_2[0].input_video_path))
+    vm_log::errore("-mkindex needs a video as input video 2 (-i2)");
 
-  if (param::frame_scale <= 0)
-    vm_log::errore(std::format("-scale {} out of range", param::frame_scale));
+  // 输入，video 1 只打开一次
+  _video_info info_1;
+  if (param::index_path.empty()) {
+    info_1 = _open_video(job, 1, job.input_video_path_1, job.formatContext_1,
+                         job.codecContext_1, job.video_stream_index_1);
+    if (!info_1.have_frame_count)
+      vm_log::warning("The video 1 is VFR");
+    job.frame_count_1 = info_1.frame_count;
+    job.frame_rate_1 = info_1.avg_frame_rate;
+  }
 
-  if (param::frame_forward <= 0 || param::frame_forward == 32767)
-    vm_log::errore(
-        std::format("-forward {} out of range", param::frame_forward));
+  for (size_t k = 0; k < job.videos_2.size(); ++k) {
+    _video_info info_2 =
+        _open_video_2(job, job.videos_2[k], static_cast<int>(2 + k), info_1);
+    // 建立索引只需要 video 2，按它的尺寸预处理
+    if (!param::index_path.empty())
+      info_1 = info_2;
+  }
 
-  // 新值
-  // 猜测帧数
-  bool have_frame_count = true;
-  AVRational r_frame_rate =
-      av_guess_frame_rate(formatContext_1, videoStream_1, nullptr);
-  if (av_cmp_q(r_frame_rate, videoStream_1->avg_frame_rate)) {
-    vm_log::warning("The video 1 is VFR");
-    have_frame_count = false;
-  } else
-    frame_count_1 = static_cast<fnum>(
-        round(static_cast<double>(formatContext_1->duration) / AV_TIME_BASE *
-              av_q2d(videoStream_1->avg_frame_rate)));
-
-  r_frame_rate = av_guess_frame_rate(formatContext_2, videoStream_2, nullptr);
-  if (av_cmp_q(r_frame_rate, videoStream_2->avg_frame_rate)) {
-    vm_log::warning("The video 2 is VFR");
-    have_frame_count = false;
-  } else
-    frame_count_2 = static_cast<fnum>(
-        round(static_cast<double>(formatContext_2->duration) / AV_TIME_BASE *
-              av_q2d(videoStream_2->avg_frame_rate)));
+  if (param::index_path.empty())
+    _scan_timelines(job);
 
-  if (!have_frame_count)
-    vm_log::warning(
-        "VFR video exists, frame rate guesses may not be accurate (Incorrect "
-        "muxing may cause a program to mistake CFR video for VFR)");
+  job.new_width = static_cast<uint32_t>(info_1.width) / job.frame_scale;
+  job.new_height = static_cast<uint32_t>(info_1.height) / job.frame_scale;
 
-  if (param::debug)
-    vm_log::info(std::format("The two videos frame counts: Metadata: {0} F & "
-                             "{1} F; Guess: {2} F & {3} F",
-                             videoStream_1->nb_frames, videoStream_2->nb_frames,
-                             frame_count_1, frame_count_2));
-
-  if (videoStream_1->nb_frames && videoStream_2->nb_frames &&
-      (frame_count_1 != videoStream_1->nb_frames ||
-       frame_count_2 != videoStream_2->nb_frames))
-    vm_log::warning(std::format(
-        "The two videos have different frame counts between metadata and "
-        "guess: Metadata: {0} F & {1} F; Guess: {2} F & {3} F",
-        videoStream_1->nb_frames, videoStream_2->nb_frames, frame_count_1,
-        frame_count_2));
+  // SSIM 至少需要 2x2 个 8x8 窗口
+  if (job.new_width < 8 || job.new_height < 8)
+    vm_log::errore(std::format("-scale {} is too large for {}x{}",
+                               job.frame_scale, info_1.width, info_1.height));
 
-  if (frame_count_1 != frame_count_2)
-    vm_log::warning(
-        std::format("The two videos have different frame counts: {0} F & {1} F",
-                    frame_count_1, frame_count_2));
+  // 粗筛层同样需要 2x2 个 8x8 窗口
+  job.coarse_width = job.new_width / pyramid_factor;
+  job.coarse_height = job.new_height / pyramid_factor;
+  if (job.pyramid && (job.coarse_width < 8 || job.coarse_height < 8)) {
+    vm_log::warning(std::format(
+        "-pyramid needs a comparison size of at least {0}x{0}, disabled",
+        8 * pyramid_factor));
+    job.pyramid = 0;
+  }
+  if (!job.pyramid)
+    job.coarse_width = job.coarse_height = 0;
 
-  if (param::debug)
-    vm_log::info(std::format(
-        "The two videos FPS: {0}/{1} FPS & {2}/{3} FPS",
-        videoStream_1->avg_frame_rate.num, videoStream_1->avg_frame_rate.den,
-        videoStream_2->avg_frame_rate.num, videoStream_2->avg_frame_rate.den));
+  // 窗口容量为 3 * forward_max + 1 帧
+  if (job.window_memory) {
+    int64_t frames = (static_cast<int64_t>(job.window_memory) << 20) /
+                     vm_window::window::frame_bytes(
+                         job.new_width, job.new_height, job.coarse_width,
+                         job.coarse_height);
+    if (frames < 4)
+      vm_log::errore(std::format("-window-memory {0} is too small for "
+                                 "{1}x{2} frames",
+                                 job.window_memory, job.new_width,
+                                 job.new_height));
+    int16_t forward_max = static_cast<int16_t>(
+        std::min<int64_t>(job.forward_max, (frames - 1) / 3));
+    if (forward_max < job.forward_max) {
+      vm_log::warning(std::format(
+          "-window-memory {0} limits -forward-max to {1}", job.window_memory,
+          forward_max));
+      job.forward_max = forward_max;
+      job.forward_min = std::min(job.forward_min, forward_max);
+      job.frame_forward = std::min(job.frame_forward, forward_max);
+    }
+  }
 
-  if (av_cmp_q(videoStream_1->avg_frame_rate, videoStream_2->avg_frame_rate))
-    vm_log::warning(std::format(
-        "The two videos have different FPS: {0}/{1} FPS & {2}/{3} FPS",
-        videoStream_1->avg_frame_rate.num, videoStream_1->avg_frame_rate.den,
-        videoStream_2->avg_frame_rate.num, videoStream_2->avg_frame_rate.den));
+  // 索引必须与本次预处理参数一致
+  for (const video_2 &video : job.videos_2)
+    if (video.index &&
+        (video.index->info().frame_scale != job.frame_scale ||
+         video.index->info().width != static_cast<int32_t>(job.new_width) ||
+         video.index->info().height != static_cast<int32_t>(job.new_height)))
+      vm_log::errore(std::format(
+          "The index \"{0}\" was built with -scale {1}, but -scale is {2}",
+          video.input_video_path, video.index->info().frame_scale,
+          job.frame_scale));
 
-  new_width = static_cast<uint32_t>(videoStream_1->codecpar->width) /
-              param::frame_scale;
-  new_height = static_cast<uint32_t>(videoStream_1->codecpar->height) /
-               param::frame_scale;
+  // 解码精度不同时像素与实时解码不同，硬件解码不使用 lowres
+  for (const video_2 &video : job.videos_2) {
+    const vm_index::header *head = video.index ? &video.index->info() : nullptr;
+    if (head &&
+        (head->decode_speed != static_cast<int32_t>(job.decode_speed) ||
+         (!param::hwaccel.empty() && head->lowres)))
+      vm_log::errore(std::format(
+          "The index \"{0}\" was built with -decode-speed {1} (lowres {2}), "
+          "but -decode-speed is {3}{4}",
+          video.input_video_path,
+          _get_decode_speed_string(
+              static_cast<decode_speed_enum>(head->decode_speed)),
+          head->lowres, _get_decode_speed_string(job.decode_speed),
+          param::hwaccel.empty() ? "" : " with -hw"));
+  }
 
-  if (param::debug)
+  if (param::debug) {
+    std::string inputs_2;
+    for (const video_2 &video : job.videos_2)
+      inputs_2 += std::format(R"(-i2 "{0}" -log "{1}" )",
+                              video.input_video_path, video.log_path);
     vm_log::info(std::format(
-        R"("{0}" -i1 "{1}" -i2 "{2}" -t {3} -log {4} -th {5} -scale {6} -forward {7} {8}-hw {9} {10} -c ff)",
-        args[0], param::input_video_path_1, param::input_video_path_2,
-        _get_output_type_string(), param::log_path, param::ssim_threshold,
-        param::frame_scale, param::frame_forward,
+        R"("{0}" -i1 "{1}" {2}-t {3} -th {4} -ssim {10} -scale {5} -forward {6} -forward-min {16} -forward-max {17} -threads {11} {20}-pyramid {13} -resync {18} {19}-segments {14} {21}-decode-speed {15} {12}{7}-hw {8} {9} -c ff)",
+        program_path, job.input_video_path_1, inputs_2,
+        _get_output_type_string(job.output_type), job.ssim_threshold,
+        job.frame_scale, job.frame_forward,
         param::benchmark ? "-benchmark " : "", param::hwaccel,
-        param::debug ? "-debug" : ""));
+        param::debug ? "-debug" : "", _get_ssim_mode_string(job.ssim_mode),
+        param::threads, job.prefilter ? "" : "-noprefilter ", job.pyramid,
+        job.segments, _get_decode_speed_string(job.decode_speed),
+        job.forward_min, job.forward_max, job.resync,
+        job.pts ? "-pts " : "", job.hash ? "" : "-nohash ",
+        job.packet ? "-packet " : ""));
+  }
 }
-} // namespace vm_option
\ No newline at end of file
+
+void close(job &job) {
+  avformat_close_input(&job.formatContext_1);
+  avcodec_free_context(&job.codecContext_1);
+  for (video_2 &video : job.videos_2) {
+    delete video.index;
+    video.index = nullptr;
+    avformat_close_input(&video.formatContext);
+    avcodec_free_context(&video.codecContext);
+  }
+}
+
+} // namespace vm_option
@@ -9,33 +9,134 @@ extern "C" {
 #include <string>
 #include <vector>
 
+#include "vm_segment.hpp"
 #include "vm_type.hpp"
 
+namespace vm_index {
+class reader;
+}
+
 namespace vm_option {
 
-enum class output_type_enum { nooutput, framenum };
+enum class output_type_enum {
+  nooutput,
+  framenum,
+  ranges,
+  json,
+  binary,
+  timestamps
+};
+
+enum class ssim_mode_enum { native, lavfi, check };
+
+enum class decode_speed_enum { full, fast, fastest };
 
 namespace param {
 
-extern std::string input_video_path_1, input_video_path_2, log_path;
-extern output_type_enum output_type;
-extern double frame_scale;
-extern double ssim_threshold;
-extern int16_t frame_forward;
+// 整个进程共用的参数，每对视频的参数见 job
+extern std::string index_path;
+extern std::string jobs_path;
+extern int concurrency;
+extern std::string stats_path;
+extern std::string progress_path;
+extern int progress_interval;
+extern int threads;
 extern bool benchmark, debug;
 extern std::string hwaccel;
 
 } // namespace param
 
-extern int8_t video_stream_index_1, video_stream_index_2;
-extern AVFormatContext *formatContext_1, *formatContext_2;
-extern AVCodecContext *codecContext_1, *codecContext_2;
+// 与 video 1 对比的一个视频，-i2 可给出多个，各自输出一份结果
+struct video_2 {
+  std::string input_video_path, log_path;
+
+  // 以下由 open 填写，由 close 释放
+  int8_t video_stream_index = -1;
+  AVFormatContext *formatContext = nullptr;
+  AVCodecContext *codecContext = nullptr;
+  // -i2 为索引文件时代替 formatContext / codecContext
+  vm_index::reader *index = nullptr;
+
+  fnum frame_count = 0;
+  AVRational frame_rate{0, 1};
+  // -pts 或 -resync 时的时间线，索引文件按帧率生成，PTS 无效时为空
+  vm_segment::timeline timeline;
+};
+
+// 一个 video 1 与一个或多个 video 2 的参数与打开后的状态
+// 命令行中的参数为默认值，-jobs 文件中每行一个 job，可覆盖其中的参数
+struct job {
+  std::string input_video_path_1;
+  // 第 k 个 -log 属于第 k 个 -i2
+  std::vector<video_2> videos_2;
+  output_type_enum output_type = output_type_enum::framenum;
+  double frame_scale = 1;
+  double ssim_threshold = 0.992;
+  ssim_mode_enum ssim_mode = ssim_mode_enum::native;
+  // 开始时的窗口大小，-forward-min 与 -forward-max 相同时固定不变
+  int16_t frame_forward = 24;
+  // 0 为与 -forward 相同，由 get_option 填写
+  int16_t forward_min = 0, forward_max = 0;
+  // 每个窗口的内存上限 (MiB)，0 为不限制，超出时减小 forward_max
+  int window_memory = 0;
+  bool prefilter = true;
+  // 内容哈希相同的帧直接视为匹配
+  bool hash = true;
+  int pyramid = 0;
+  // 连续这么多帧未匹配后在镜头切换处重新对齐，0 为关闭
+  int resync = 0;
+  // 按时间戳预测 video 2 中的位置
+  bool pts = false;
+  int segments = 1;
+  // 先按包哈希对齐，只解码未对齐的部分
+  bool packet = false;
+  decode_speed_enum decode_speed = decode_speed_enum::full;
+  // 每个解码器的线程数，0 为 FFmpeg 自动选择
+  int decode_threads = 0;
+  // -jobs 中参数、校验或打开出错，不再匹配
+  bool failed = false;
 
+  // 以下由 open 填写，由 close 释放
+  int8_t video_stream_index_1 = -1;
+  AVFormatContext *formatContext_1 = nullptr;
+  AVCodecContext *codecContext_1 = nullptr;
+
+  fnum frame_count_1 = 0;
+  // -pts 时的时间线
+  vm_segment::timeline timeline_1;
+  // 所有视频的宽高相同
+  uint32_t new_width = 0, new_height = 0;
+  // -pyramid 粗筛层的尺寸，未开启时为 0
+  uint32_t coarse_width = 0, coarse_height = 0;
+  AVRational frame_rate_1{0, 1};
+};
+
+// 要匹配的 job，没有 -jobs 时只有命令行给出的一个
+extern std::vector<job> jobs;
+
+// 解析参数，没有 -jobs 时同时打开 jobs[0]，失败时退出
+// -jobs 中单个 job 的参数出错时只将其标记为 failed
 void get_option(std::vector<std::string> &args);
 
+// 打开 job 的所有视频并校验参数，-mkindex 时只打开 video 2，失败时退出
+// 存在 vm_log::job_scope 时失败抛出 vm_log::job_error
+void open(job &job);
+
+// 释放 open 打开的内容
+void close(job &job);
+
+// 打开视频并初始化解码器，num 为视频编号，用于提示信息，失败时退出
+// 多个 -i2 时依次编号为 video 2, 3, ...
+void open_video(const job &job, int num, const std::string &path,
+                AVFormatContext *&format_ctx, AVCodecContext *&codec_ctx,
+                int8_t &stream_index);
+
 void fun1();
 
-extern fnum frame_count_1, frame_count_2;
-extern uint32_t new_width, new_height;
+// -pyramid 粗筛层相对 new_width x new_height 的缩小倍数
+constexpr int pyramid_factor = 8;
+
+// -resync 每次跳转时最多向后索引的 video 2 帧数
+constexpr fnum resync_lookahead = 4096;
 
-} // namespace vm_option
\ No newline at end of file
+} // namespace vm_option
@@ -1,36 +1,190 @@
 #include "vm_output.hpp"
 
-#include "vm_log.hpp"
-#include "vm_match.hpp"
-#include "vm_option.hpp"
-
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <format>
 #include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+
+#include "vm_log.hpp"
+#include "vm_option.hpp"
+#include "vm_stats.hpp"
+#include "vm_utils.hpp"
 
 namespace vm_output {
 
-void vm_output() {
-  if (vm_option::param::output_type == vm_option::output_type_enum::framenum)
-    for (fnum i = 0; i < vm_option::frame_count_1; ++i)
-      vm_log::output(std::format(
-          R"({0}->{1})", i,
-          vm_match::match_frame_list[i] == -1
-              ? static_cast<int64_t>(-1)
-              : static_cast<int64_t>(vm_match::match_frame_list[i])));
-
-  if (!vm_option::param::log_path.empty()) {
-    std::ofstream log_file(vm_option::param::log_path, std::ios::out);
-    if (log_file.is_open()) {
-      for (fnum i = 0; i < vm_option::frame_count_1; ++i)
-        log_file << i << "->"
-                 << (vm_match::match_frame_list[i] == -1
-                         ? static_cast<int64_t>(-1)
-                         : static_cast<int64_t>(vm_match::match_frame_list[i]))
-                 << '\n';
-      log_file.close();
-    } else
-      vm_log::error("unable to open log file");
+// 缓冲区达到此大小或距上次刷新超过 flush_interval 时写出
+constexpr size_t buffer_size = 64 * 1024;
+constexpr std::chrono::milliseconds flush_interval(100);
+
+writer::writer(std::ostream &stream, vm_option::output_type_enum type,
+               const vm_segment::timeline *timeline_1,
+               const vm_segment::timeline *timeline_2)
+    : stream(stream), type(type), timeline_1(timeline_1),
+      timeline_2(timeline_2), last_flush(std::chrono::steady_clock::now()) {
+  buffer.reserve(buffer_size);
+  if (type == vm_option::output_type_enum::json)
+    buffer += "[";
+}
+
+void writer::append(fnum frame_1, fnum frame_2) {
+  switch (type) {
+  case vm_option::output_type_enum::ranges:
+  case vm_option::output_type_enum::json:
+    // 与当前段偏移相同时延长
+    if (run_length &&
+        (frame_2 == -1 ? run_2 == -1
+                       : run_2 != -1 && frame_2 == run_2 + run_length)) {
+      ++run_length;
+      return;
+    }
+    _append_run();
+    run_1 = frame_1;
+    run_2 = frame_2;
+    run_length = 1;
+    break;
+  case vm_option::output_type_enum::binary: {
+    int32_t value = frame_2;
+    if constexpr (std::endian::native == std::endian::big)
+      value = static_cast<int32_t>(
+          std::byteswap(static_cast<uint32_t>(value)));
+    char bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    buffer.append(bytes, sizeof(bytes));
+    break;
+  }
+  case vm_option::output_type_enum::timestamps:
+    _append_number(frame_1);
+    _append_time(timeline_1, frame_1);
+    buffer += "->";
+    _append_number(frame_2);
+    if (frame_2 != -1)
+      _append_time(timeline_2, frame_2);
+    buffer += '\n';
+    break;
+  default:
+    _append_number(frame_1);
+    buffer += "->";
+    _append_number(frame_2);
+    buffer += '\n';
+    break;
+  }
+
+  if (buffer.size() >= buffer_size ||
+      std::chrono::steady_clock::now() - last_flush >= flush_interval)
+    flush();
+}
+
+void writer::flush() {
+  stream.write(buffer.data(), buffer.size());
+  stream.flush();
+  buffer.clear();
+  last_flush = std::chrono::steady_clock::now();
+}
+
+void writer::finish() {
+  _append_run();
+  if (type == vm_option::output_type_enum::json)
+    buffer += "\n]\n";
+  flush();
+}
+
+void writer::_append_number(fnum value) {
+  char digits[16];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  buffer.append(digits, result.ptr);
+}
+
+// " 秒数"，保留到微秒
+void writer::_append_time(const vm_segment::timeline *timeline,
+                          fnum frame_num) {
+  char digits[32];
+  auto result =
+      std::to_chars(digits + 1, digits + sizeof(digits),
+                    timeline ? timeline->time(frame_num) : 0.0,
+                    std::chars_format::fixed, 6);
+  digits[0] = ' ';
+  buffer.append(digits, result.ptr);
+}
+
+// ranges: "a-b -> c-d"，单帧为 "a -> c"，未匹配为 "a-b -> -1"
+// json: {"begin_1": a, "end_1": b, "begin_2": c, "end_2": d}，未匹配时为 -1
+void writer::_append_run() {
+  if (!run_length)
+    return;
+  fnum end_1 = run_1 + run_length - 1;
+  fnum end_2 = run_2 == -1 ? -1 : run_2 + run_length - 1;
+
+  if (type == vm_option::output_type_enum::json) {
+    buffer += run_count ? ",\n  " : "\n  ";
+    buffer += R"({"begin_1": )";
+    _append_number(run_1);
+    buffer += R"(, "end_1": )";
+    _append_number(end_1);
+    buffer += R"(, "begin_2": )";
+    _append_number(run_2);
+    buffer += R"(, "end_2": )";
+    _append_number(end_2);
+    buffer += "}";
+  } else {
+    _append_number(run_1);
+    if (run_length > 1) {
+      buffer += '-';
+      _append_number(end_1);
+    }
+    buffer += " -> ";
+    _append_number(run_2);
+    if (run_length > 1 && run_2 != -1) {
+      buffer += '-';
+      _append_number(end_2);
+    }
+    buffer += '\n';
+  }
+
+  ++run_count;
+  run_length = 0;
+}
+
+output::output(const vm_option::job &job, const vm_option::video_2 &video,
+               bool to_stdout) {
+  vm_option::output_type_enum type = job.output_type;
+  if (to_stdout && type != vm_option::output_type_enum::nooutput &&
+      type != vm_option::output_type_enum::binary)
+    stdout_writer = std::make_unique<writer>(std::cout, type, &job.timeline_1,
+                                             &video.timeline);
+
+  if (!video.log_path.empty()) {
+    if (type == vm_option::output_type_enum::nooutput)
+      type = vm_option::output_type_enum::framenum;
+    log_file.open(vm_utils::utf8_to_path(video.log_path),
+                  type == vm_option::output_type_enum::binary
+                      ? std::ios::out | std::ios::binary
+                      : std::ios::out);
+    if (log_file.is_open())
+      log_writer = std::make_unique<writer>(log_file, type, &job.timeline_1,
+                                            &video.timeline);
+    else
+      vm_log::error(
+          std::format("unable to open log file \"{0}\"", video.log_path));
   }
 }
 
-} // namespace vm_output
\ No newline at end of file
+output::~output() {
+  for (writer *writer : {stdout_writer.get(), log_writer.get()})
+    if (writer)
+      writer->finish();
+}
+
+void output::write(fnum frame_1, fnum frame_2) {
+  vm_stats::timer timer(vm_stats::stage::output);
+  if (stdout_writer)
+    stdout_writer->append(frame_1, frame_2);
+  if (log_writer)
+    log_writer->append(frame_1, frame_2);
+}
+
+} // namespace vm_output
@@ -1,7 +1,67 @@
 #pragma once
 
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "vm_option.hpp"
+#include "vm_type.hpp"
+
 namespace vm_output {
 
-extern void vm_output();
+// 按一种输出格式写一个流，经缓冲后定期刷新，下游可边匹配边读取
+// ranges 与 json 只在偏移变化时产生输出，大小与编辑次数成正比
+class writer {
+public:
+  // timestamps 按 timeline_1 与 timeline_2 换算帧号的时间
+  writer(std::ostream &stream, vm_option::output_type_enum type,
+         const vm_segment::timeline *timeline_1 = nullptr,
+         const vm_segment::timeline *timeline_2 = nullptr);
+
+  writer(const writer &) = delete;
+  writer &operator=(const writer &) = delete;
+
+  // 帧号必须从 0 开始连续递增
+  void append(fnum frame_1, fnum frame_2);
+  void flush();
+  // 写出最后一段并刷新
+  void finish();
+
+private:
+  void _append_number(fnum value);
+  void _append_time(const vm_segment::timeline *timeline, fnum frame_num);
+  void _append_run();
+
+  std::ostream &stream;
+  vm_option::output_type_enum type;
+  const vm_segment::timeline *timeline_1, *timeline_2;
+  std::string buffer;
+  std::chrono::steady_clock::time_point last_flush;
+  // 尚未写出的一段
+  fnum run_1 = 0, run_2 = 0, run_length = 0;
+  size_t run_count = 0;
+};
+
+// job 中一个 video 2 的输出，按 -type 与它的 -log 打开
+// 析构时写出剩余内容并关闭
+class output {
+public:
+  // to_stdout 为 false 时只写 -log 文件
+  output(const vm_option::job &job, const vm_option::video_2 &video,
+         bool to_stdout);
+  ~output();
+
+  output(const output &) = delete;
+  output &operator=(const output &) = delete;
+
+  // 写出 video 1 帧 frame_1 的结果，帧号必须从 0 开始连续递增
+  void write(fnum frame_1, fnum frame_2);
+
+private:
+  std::ofstream log_file;
+  std::unique_ptr<writer> stdout_writer, log_writer;
+};
 
-}
\ No newline at end of file
+} // namespace vm_output
@@ -0,0 +1,82 @@
+#include "vm_pool.hpp"
+
+#include <algorithm>
+
+namespace vm_pool {
+
+pool::pool(unsigned worker_count) {
+  workers.reserve(worker_count);
+  for (unsigned i = 0; i < worker_count; ++i)
+    workers.emplace_back(&pool::_work, this);
+}
+
+pool::~pool() {
+  {
+    std::lock_guard lock(mutex);
+    stop = true;
+  }
+  task_cv.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+void pool::_run(batch &b) {
+  for (size_t i; (i = b.next.fetch_add(1)) < b.count;) {
+    (*b.fn)(i);
+    b.done.fetch_add(1);
+  }
+}
+
+void pool::_work() {
+  while (true) {
+    batch *b;
+    {
+      std::unique_lock lock(mutex);
+      task_cv.wait(lock, [this] { return stop || !batches.empty(); });
+      if (stop)
+        return;
+
+      b = batches.front();
+      // 已全部领取的批次不再分发
+      if (b->next.load() >= b->count) {
+        batches.pop_front();
+        continue;
+      }
+      ++b->active;
+    }
+
+    _run(*b);
+
+    {
+      std::lock_guard lock(mutex);
+      --b->active;
+    }
+    done_cv.notify_all();
+  }
+}
+
+void pool::parallel_for(size_t count, const std::function<void(size_t)> &fn) {
+  if (workers.empty() || count <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  batch b{&fn, count};
+  {
+    std::lock_guard lock(mutex);
+    batches.push_back(&b);
+  }
+  task_cv.notify_all();
+
+  _run(b);
+
+  // 等待工作线程完成并释放对 b 的引用
+  std::unique_lock lock(mutex);
+  if (auto it = std::find(batches.begin(), batches.end(), &b);
+      it != batches.end())
+    batches.erase(it);
+  done_cv.wait(lock, [&b] { return b.done.load() == b.count && !b.active; });
+}
+
+} // namespace vm_pool
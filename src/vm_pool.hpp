@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vm_pool {
+
+// 常驻线程池，调用 parallel_for 的线程也参与计算
+class pool {
+public:
+  explicit pool(unsigned worker_count);
+  ~pool();
+
+  pool(const pool &) = delete;
+  pool &operator=(const pool &) = delete;
+
+  // 对 [0, count) 执行 fn，按下标从小到大领取任务，返回时全部完成
+  // 可由多个线程同时调用
+  void parallel_for(size_t count, const std::function<void(size_t)> &fn);
+
+  unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+private:
+  struct batch {
+    const std::function<void(size_t)> *fn;
+    size_t count;
+    std::atomic<size_t> next{0}, done{0};
+    unsigned active = 0; // 正在执行该批次的工作线程数，受 mutex 保护
+  };
+
+  void _work();
+  static void _run(batch &b);
+
+  std::mutex mutex;
+  std::condition_variable task_cv, done_cv;
+  std::deque<batch *> batches;
+  bool stop = false;
+  std::vector<std::thread> workers;
+};
+
+} // namespace vm_pool
@@ -0,0 +1,110 @@
+#include "vm_progress.hpp"
+
+#include <algorithm>
+#include <format>
+#include <string>
+
+#include "vm_log.hpp"
+#include "vm_option.hpp"
+#include "vm_stats.hpp"
+#include "vm_utils.hpp"
+
+namespace vm_progress {
+
+// 窗口标题的刷新间隔
+constexpr std::chrono::milliseconds title_interval(100);
+
+reporter::reporter(fnum total, size_t window_capacity)
+    : total(std::max<fnum>(0, total)), window_capacity(window_capacity),
+      start(std::chrono::steady_clock::now()), last_time(start) {
+  const std::string &path = vm_option::param::progress_path;
+  if (path.starts_with("fd:")) {
+    int fd = std::stoi(path.substr(3));
+    // 标准输出与标准错误直接使用，其余描述符不随记录结束关闭
+    file = fd == 1   ? stdout
+           : fd == 2 ? stderr
+#ifdef _WIN32
+                     : _fdopen(fd, "w");
+#else
+                     : fdopen(fd, "w");
+#endif
+  } else if (!path.empty()) {
+#ifdef _WIN32
+    file = _wfopen(vm_utils::utf8_to_path(path).c_str(), L"w");
+#else
+    file = std::fopen(path.c_str(), "w");
+#endif
+    own_file = true;
+  }
+  if (!path.empty() && !file)
+    vm_log::errore(std::format("Can not open the progress output \"{0}\"",
+                               path));
+
+  thread = std::jthread([this](std::stop_token stop) { _run(stop); });
+}
+
+reporter::~reporter() {
+  thread.request_stop();
+  thread.join();
+  if (file) {
+    _record(true);
+    if (own_file)
+      std::fclose(file);
+  }
+}
+
+void reporter::_run(std::stop_token stop) {
+  std::chrono::milliseconds interval(vm_option::param::progress_interval);
+  auto next_record = start + interval;
+  std::unique_lock lock(mutex);
+  while (!wake.wait_for(lock, stop, title_interval, [] { return false; }) &&
+         !stop.stop_requested()) {
+    uint64_t frames = vm_stats::get(vm_stats::counter::frames_1);
+    fnum total = this->total;
+    vm_log::change_title(
+        total ? std::format("{0} / {1} {2:.1f}%", frames, total,
+                            100.0 * frames / total)
+              : std::format("{0}", frames));
+
+    if (file && std::chrono::steady_clock::now() >= next_record) {
+      _record(false);
+      next_record += interval;
+    }
+  }
+}
+
+// fps 与每秒对比次数取自上一条记录之后，最后一条记录取全程平均
+void reporter::_record(bool done) {
+  auto now = std::chrono::steady_clock::now();
+  uint64_t frames = vm_stats::get(vm_stats::counter::frames_1);
+  uint64_t compare = vm_stats::get(vm_stats::counter::compare);
+  fnum total = this->total;
+  double elapsed = std::chrono::duration<double>(now - start).count();
+  double seconds =
+      done ? elapsed : std::chrono::duration<double>(now - last_time).count();
+  seconds = std::max(seconds, 1e-9);
+  double fps = (done ? frames : frames - last_frames) / seconds;
+  double compare_rate = (done ? compare : compare - last_compare) / seconds;
+  last_time = now;
+  last_frames = frames;
+  last_compare = compare;
+
+  // 剩余时间按全程平均速度估计
+  double average = frames / std::max(elapsed, 1e-9);
+  std::string eta =
+      total && !done && frames && static_cast<uint64_t>(total) > frames
+          ? std::format("{0:.1f}", (total - frames) / average)
+          : done ? "0" : "null";
+
+  std::string line = std::format(
+      R"({{"elapsed": {0:.3f}, "frames": {1}, "total": {2}, "fps": {3:.2f}, )"
+      R"("eta": {4}, "comparisons_per_second": {5:.1f}, )"
+      R"("window_frames": {6}, "window_capacity": {7}, "done": {8}}})"
+      "\n",
+      elapsed, frames, total, fps, eta, compare_rate,
+      vm_stats::window_frames(), window_capacity, done);
+  std::fputs(line.c_str(), file);
+  std::fflush(file);
+}
+
+} // namespace vm_progress
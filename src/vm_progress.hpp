@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "vm_type.hpp"
+
+namespace vm_progress {
+
+// 匹配期间定期更新窗口标题，并按 -progress 写出每行一条的 JSON 进度记录
+// 数据取自 vm_stats 的原子计数，析构时停止线程并写出 "done": true 的记录
+class reporter {
+public:
+  // total 为 video 1 的帧数，未知时为 0，window_capacity 为单个窗口的容量
+  reporter(fnum total, size_t window_capacity);
+  ~reporter();
+
+  reporter(const reporter &) = delete;
+  reporter &operator=(const reporter &) = delete;
+
+  // 匹配开始后得到准确帧数时更新，如由时间线得出
+  void set_total(fnum total) { this->total = std::max<fnum>(0, total); }
+
+private:
+  void _run(std::stop_token stop);
+  void _record(bool done);
+
+  std::atomic<fnum> total;
+  size_t window_capacity;
+  std::FILE *file = nullptr;
+  bool own_file = false;
+
+  std::chrono::steady_clock::time_point start, last_time;
+  uint64_t last_frames = 0, last_compare = 0;
+
+  std::mutex mutex;
+  std::condition_variable_any wake;
+  std::jthread thread;
+};
+
+} // namespace vm_progress
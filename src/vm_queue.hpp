@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace vm_queue {
+
+// 有界单生产者单消费者队列，满时阻塞生产者，空时阻塞消费者
+// 每帧只操作一次，加锁开销可以忽略
+template <typename T> class spsc_queue {
+public:
+  explicit spsc_queue(size_t capacity) : buffer(capacity ? capacity : 1) {}
+
+  spsc_queue(const spsc_queue &) = delete;
+  spsc_queue &operator=(const spsc_queue &) = delete;
+
+  // 队列关闭时返回 false，value 未被取走
+  bool push(T &value) {
+    std::unique_lock lock(mutex);
+    not_full.wait(lock, [this] { return closed || size < buffer.size(); });
+    if (closed)
+      return false;
+
+    buffer[(head + size) % buffer.size()] = std::move(value);
+    ++size;
+    lock.unlock();
+    not_empty.notify_one();
+    return true;
+  }
+
+  // 队列为空且已关闭时返回 std::nullopt
+  std::optional<T> pop() {
+    std::unique_lock lock(mutex);
+    not_empty.wait(lock, [this] { return closed || size; });
+    if (!size)
+      return std::nullopt;
+
+    T value = std::move(buffer[head]);
+    head = (head + 1) % buffer.size();
+    --size;
+    lock.unlock();
+    not_full.notify_one();
+    return value;
+  }
+
+  // 生产者结束或消费者放弃时调用，唤醒双方
+  void close() {
+    {
+      std::lock_guard lock(mutex);
+      closed = true;
+    }
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+private:
+  std::vector<T> buffer;
+  size_t head = 0, size = 0;
+  bool closed = false;
+  std::mutex mutex;
+  std::condition_variable not_full, not_empty;
+};
+
+} // namespace vm_queue
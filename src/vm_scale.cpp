@@ -0,0 +1,319 @@
+#include "vm_scale.hpp"
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include "vm_cpu.hpp"
+#include "vm_log.hpp"
+
+#if VM_X86
+#include <immintrin.h>
+#endif
+
+namespace vm_scale {
+
+// 每个线程独立持有的缓存，线程退出时释放
+struct _thread_cache {
+  SwsContext *sws_ctx = nullptr;
+  AVFrame *sw_frame = nullptr;
+
+  ~_thread_cache() {
+    sws_freeContext(sws_ctx);
+    av_frame_free(&sw_frame);
+  }
+};
+
+thread_local _thread_cache cache;
+
+// Y 平面是否可以直接当作 GRAY8 使用
+bool _is_plain_luma(AVPixelFormat format) {
+  switch (format) {
+  // swscale 转 GRAY8 时会对 JPEG 范围做转换，需保持一致
+  case AV_PIX_FMT_YUVJ411P:
+  case AV_PIX_FMT_YUVJ420P:
+  case AV_PIX_FMT_YUVJ422P:
+  case AV_PIX_FMT_YUVJ440P:
+  case AV_PIX_FMT_YUVJ444P:
+    return false;
+  default:
+    break;
+  }
+
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+  if (!desc || desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL |
+                              AV_PIX_FMT_FLAG_HWACCEL |
+                              AV_PIX_FMT_FLAG_BITSTREAM))
+    return false;
+
+  const AVComponentDescriptor &luma = desc->comp[0];
+  return luma.plane == 0 && luma.step == 1 && luma.depth == 8 &&
+         luma.shift == 0 && luma.offset == 0;
+}
+
+AVFrame *_alloc_gray(int width, int height) {
+  AVFrame *gray = av_frame_alloc();
+  if (!gray)
+    vm_log::errore("vm_scale::_alloc_gray: av_frame_alloc: error");
+
+  gray->width = width;
+  gray->height = height;
+  gray->format = AV_PIX_FMT_GRAY8;
+  if (av_frame_get_buffer(gray, 64) < 0) {
+    av_frame_free(&gray);
+    vm_log::errore("vm_scale::_alloc_gray: av_frame_get_buffer: error");
+  }
+  return gray;
+}
+
+// 零拷贝: 引用原帧，只保留 Y 平面
+AVFrame *_ref_luma(const AVFrame *frame) {
+  AVFrame *gray = av_frame_alloc();
+  if (!gray || av_frame_ref(gray, frame) < 0) {
+    av_frame_free(&gray);
+    vm_log::errore("vm_scale::_ref_luma: av_frame_ref: error");
+  }
+
+  for (int i = 1; i < AV_NUM_DATA_POINTERS; ++i) {
+    gray->data[i] = nullptr;
+    gray->linesize[i] = 0;
+  }
+  gray->format = AV_PIX_FMT_GRAY8;
+  return gray;
+}
+
+void _box_c(const uint8_t *src, int src_linesize, uint8_t *dst,
+            int dst_linesize, int x_begin, int width, int height,
+            int factor) {
+  const int area = factor * factor;
+  for (int y = 0; y < height; ++y) {
+    const uint8_t *row =
+        src + static_cast<ptrdiff_t>(y) * factor * src_linesize;
+    uint8_t *out = dst + static_cast<ptrdiff_t>(y) * dst_linesize;
+    for (int x = x_begin; x < width; ++x) {
+      int sum = 0;
+      for (int dy = 0; dy < factor; ++dy) {
+        const uint8_t *p = row + static_cast<ptrdiff_t>(dy) * src_linesize +
+                           x * factor;
+        for (int dx = 0; dx < factor; ++dx)
+          sum += p[dx];
+      }
+      out[x] = static_cast<uint8_t>((sum + area / 2) / area);
+    }
+  }
+}
+
+#if VM_X86
+VM_TARGET("ssse3")
+void _box2_ssse3(const uint8_t *src, int src_linesize, uint8_t *dst,
+                 int dst_linesize, int width, int height) {
+  const __m128i ones = _mm_set1_epi8(1), round = _mm_set1_epi16(2);
+  int simd_width = width & ~15;
+  for (int y = 0; y < height; ++y) {
+    const uint8_t *r0 = src + static_cast<ptrdiff_t>(y) * 2 * src_linesize;
+    const uint8_t *r1 = r0 + src_linesize;
+    uint8_t *out = dst + static_cast<ptrdiff_t>(y) * dst_linesize;
+    for (int x = 0; x < simd_width; x += 16) {
+      const __m128i *a = reinterpret_cast<const __m128i *>(r0 + 2 * x);
+      const __m128i *b = reinterpret_cast<const __m128i *>(r1 + 2 * x);
+      __m128i lo = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128(a), ones),
+                                 _mm_maddubs_epi16(_mm_loadu_si128(b), ones));
+      __m128i hi =
+          _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128(a + 1), ones),
+                        _mm_maddubs_epi16(_mm_loadu_si128(b + 1), ones));
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 2);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 2);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                       _mm_packus_epi16(lo, hi));
+    }
+  }
+  _box_c(src, src_linesize, dst, dst_linesize, simd_width, width, height, 2);
+}
+
+VM_TARGET("avx2")
+void _box2_avx2(const uint8_t *src, int src_linesize, uint8_t *dst,
+                int dst_linesize, int width, int height) {
+  const __m256i ones = _mm256_set1_epi8(1), round = _mm256_set1_epi16(2);
+  int simd_width = width & ~31;
+  for (int y = 0; y < height; ++y) {
+    const uint8_t *r0 = src + static_cast<ptrdiff_t>(y) * 2 * src_linesize;
+    const uint8_t *r1 = r0 + src_linesize;
+    uint8_t *out = dst + static_cast<ptrdiff_t>(y) * dst_linesize;
+    for (int x = 0; x < simd_width; x += 32) {
+      const __m256i *a = reinterpret_cast<const __m256i *>(r0 + 2 * x);
+      const __m256i *b = reinterpret_cast<const __m256i *>(r1 + 2 * x);
+      __m256i lo =
+          _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256(a), ones),
+                           _mm256_maddubs_epi16(_mm256_loadu_si256(b), ones));
+      __m256i hi = _mm256_add_epi16(
+          _mm256_maddubs_epi16(_mm256_loadu_si256(a + 1), ones),
+          _mm256_maddubs_epi16(_mm256_loadu_si256(b + 1), ones));
+      lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 2);
+      hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 2);
+      // packus 按 128 bit 通道交错，需重排回顺序
+      _mm256_storeu_si256(
+          reinterpret_cast<__m256i *>(out + x),
+          _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+    }
+  }
+  _box_c(src, src_linesize, dst, dst_linesize, simd_width, width, height, 2);
+}
+
+VM_TARGET("ssse3")
+void _box4_ssse3(const uint8_t *src, int src_linesize, uint8_t *dst,
+                 int dst_linesize, int width, int height) {
+  const __m128i ones_8 = _mm_set1_epi8(1), ones_16 = _mm_set1_epi16(1),
+                round = _mm_set1_epi32(8);
+  int simd_width = width & ~7;
+  for (int y = 0; y < height; ++y) {
+    const uint8_t *row = src + static_cast<ptrdiff_t>(y) * 4 * src_linesize;
+    uint8_t *out = dst + static_cast<ptrdiff_t>(y) * dst_linesize;
+    for (int x = 0; x < simd_width; x += 8) {
+      __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+      for (int dy = 0; dy < 4; ++dy) {
+        const __m128i *p = reinterpret_cast<const __m128i *>(
+            row + static_cast<ptrdiff_t>(dy) * src_linesize + 4 * x);
+        lo = _mm_add_epi16(lo, _mm_maddubs_epi16(_mm_loadu_si128(p), ones_8));
+        hi = _mm_add_epi16(hi,
+                           _mm_maddubs_epi16(_mm_loadu_si128(p + 1), ones_8));
+      }
+      lo = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(lo, ones_16), round), 4);
+      hi = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(hi, ones_16), round), 4);
+      __m128i packed = _mm_packs_epi32(lo, hi);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x),
+                       _mm_packus_epi16(packed, packed));
+    }
+  }
+  _box_c(src, src_linesize, dst, dst_linesize, simd_width, width, height, 4);
+}
+
+VM_TARGET("avx2")
+void _box4_avx2(const uint8_t *src, int src_linesize, uint8_t *dst,
+                int dst_linesize, int width, int height) {
+  const __m256i ones_8 = _mm256_set1_epi8(1), ones_16 = _mm256_set1_epi16(1),
+                round = _mm256_set1_epi32(8);
+  int simd_width = width & ~15;
+  for (int y = 0; y < height; ++y) {
+    const uint8_t *row = src + static_cast<ptrdiff_t>(y) * 4 * src_linesize;
+    uint8_t *out = dst + static_cast<ptrdiff_t>(y) * dst_linesize;
+    for (int x = 0; x < simd_width; x += 16) {
+      __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+      for (int dy = 0; dy < 4; ++dy) {
+        const __m256i *p = reinterpret_cast<const __m256i *>(
+            row + static_cast<ptrdiff_t>(dy) * src_linesize + 4 * x);
+        lo = _mm256_add_epi16(
+            lo, _mm256_maddubs_epi16(_mm256_loadu_si256(p), ones_8));
+        hi = _mm256_add_epi16(
+            hi, _mm256_maddubs_epi16(_mm256_loadu_si256(p + 1), ones_8));
+      }
+      lo = _mm256_srli_epi32(
+          _mm256_add_epi32(_mm256_madd_epi16(lo, ones_16), round), 4);
+      hi = _mm256_srli_epi32(
+          _mm256_add_epi32(_mm256_madd_epi16(hi, ones_16), round), 4);
+      // 两次 pack 均按 128 bit 通道交错，逐步重排
+      __m256i packed =
+          _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+      packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(packed, packed),
+                                        0x08);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                       _mm256_castsi256_si128(packed));
+    }
+  }
+  _box_c(src, src_linesize, dst, dst_linesize, simd_width, width, height, 4);
+}
+#endif
+
+using _box_fn = void (*)(const uint8_t *, int, uint8_t *, int, int, int);
+
+_box_fn _select_box2() {
+#if VM_X86
+  switch (vm_cpu::detect()) {
+  case vm_cpu::simd_level::avx2:
+    return _box2_avx2;
+  case vm_cpu::simd_level::sse41:
+  case vm_cpu::simd_level::ssse3:
+    return _box2_ssse3;
+  default:
+    break;
+  }
+#endif
+  return nullptr;
+}
+
+_box_fn _select_box4() {
+#if VM_X86
+  switch (vm_cpu::detect()) {
+  case vm_cpu::simd_level::avx2:
+    return _box4_avx2;
+  case vm_cpu::simd_level::sse41:
+  case vm_cpu::simd_level::ssse3:
+    return _box4_ssse3;
+  default:
+    break;
+  }
+#endif
+  return nullptr;
+}
+
+void box_downscale(const uint8_t *src, int src_linesize, uint8_t *dst,
+                   int dst_linesize, int width, int height, int factor) {
+  static const _box_fn box2 = _select_box2(), box4 = _select_box4();
+
+  if (factor == 2 && box2)
+    box2(src, src_linesize, dst, dst_linesize, width, height);
+  else if (factor == 4 && box4)
+    box4(src, src_linesize, dst, dst_linesize, width, height);
+  else
+    _box_c(src, src_linesize, dst, dst_linesize, 0, width, height, factor);
+}
+
+AVFrame *downscale(const AVFrame *gray, int factor) {
+  AVFrame *result = _alloc_gray(gray->width / factor, gray->height / factor);
+  box_downscale(gray->data[0], gray->linesize[0], result->data[0],
+                result->linesize[0], result->width, result->height, factor);
+  return result;
+}
+
+AVFrame *to_gray(const AVFrame *frame, int width, int height) {
+  // 硬件帧先下载到内存
+  if (frame->hw_frames_ctx) {
+    if (!cache.sw_frame)
+      cache.sw_frame = av_frame_alloc();
+    av_frame_unref(cache.sw_frame);
+    if (av_hwframe_transfer_data(cache.sw_frame, frame, 0) < 0)
+      vm_log::errore("vm_scale::to_gray: av_hwframe_transfer_data: error");
+    frame = cache.sw_frame;
+  }
+
+  AVPixelFormat format = static_cast<AVPixelFormat>(frame->format);
+
+  if (_is_plain_luma(format)) {
+    if (frame->width == width && frame->height == height)
+      return _ref_luma(frame);
+
+    // 整数倍缩小
+    int factor = width > 0 ? frame->width / width : 0;
+    if (factor > 1 && frame->width / factor == width &&
+        frame->height / factor == height) {
+      AVFrame *gray = _alloc_gray(width, height);
+      box_downscale(frame->data[0], frame->linesize[0], gray->data[0],
+                    gray->linesize[0], width, height, factor);
+      return gray;
+    }
+  }
+
+  cache.sws_ctx = sws_getCachedContext(
+      cache.sws_ctx, frame->width, frame->height, format, width, height,
+      AV_PIX_FMT_GRAY8, SWS_POINT, nullptr, nullptr, nullptr);
+  if (!cache.sws_ctx)
+    vm_log::errore("vm_scale::to_gray: sws_getCachedContext: error");
+
+  AVFrame *gray = _alloc_gray(width, height);
+  sws_scale(cache.sws_ctx, frame->data, frame->linesize, 0, frame->height,
+            gray->data, gray->linesize);
+  return gray;
+}
+
+} // namespace vm_scale
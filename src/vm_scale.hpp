@@ -0,0 +1,24 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include <cstdint>
+
+namespace vm_scale {
+
+// 将解码帧转换为 width x height 的 GRAY8 帧，返回的帧用 av_frame_free 释放
+// 1. 亮度平面即为所需图像时，直接引用原帧的 Y 平面，不拷贝
+// 2. 整数倍缩小时，使用 SIMD box 缩小 Y 平面
+// 3. 其余情况使用每线程缓存复用的 SwsContext
+AVFrame *to_gray(const AVFrame *frame, int width, int height);
+
+// 对 8 bit 平面做 factor x factor 的 box 缩小，width height 为输出尺寸
+void box_downscale(const uint8_t *src, int src_linesize, uint8_t *dst,
+                   int dst_linesize, int width, int height, int factor);
+
+// 将 GRAY8 帧整数倍 box 缩小为新帧，返回的帧用 av_frame_free 释放
+AVFrame *downscale(const AVFrame *gray, int factor);
+
+} // namespace vm_scale
@@ -0,0 +1,197 @@
+#include "vm_segment.hpp"
+
+extern "C" {
+#include <libavutil/crc.h>
+}
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <unordered_map>
+
+#include "vm_log.hpp"
+#include "vm_ssim.hpp"
+#include "vm_utils.hpp"
+
+namespace vm_segment {
+
+fnum timeline::index(int64_t frame_pts) const {
+  auto it = std::lower_bound(pts.begin(), pts.end(), frame_pts);
+  if (it == pts.end() || *it != frame_pts)
+    return -1;
+  return static_cast<fnum>(it - pts.begin());
+}
+
+double timeline::time(fnum frame_num) const {
+  if (pts.empty())
+    return 0;
+  frame_num = std::clamp(frame_num, 0, size() - 1);
+  return (pts[frame_num] - pts.front()) * av_q2d(time_base);
+}
+
+fnum timeline::at(double seconds) const {
+  if (pts.empty())
+    return 0;
+  int64_t target = pts.front() + std::llround(seconds / av_q2d(time_base));
+  auto it = std::lower_bound(pts.begin(), pts.end(), target);
+  if (it == pts.end() ||
+      (it != pts.begin() && target - *(it - 1) < *it - target))
+    --it;
+  return static_cast<fnum>(it - pts.begin());
+}
+
+bool scan(const std::string &path, int stream_index, timeline &result,
+          std::vector<packet> *packets) {
+  AVFormatContext *format_ctx = nullptr;
+  if (auto _res =
+          avformat_open_input(&format_ctx, path.c_str(), nullptr, nullptr);
+      _res != 0) {
+    vm_log::error(
+        std::format("vm_segment::scan: \"{0}\" can not be opened: {1}", path,
+                    vm_utils::ff_err_to_str(_res)));
+    return false;
+  }
+
+  AVPacket *packet = av_packet_alloc();
+  if (!packet)
+    vm_log::errore("vm_segment::scan: av_packet_alloc: error");
+  result.time_base = format_ctx->streams[stream_index]->time_base;
+
+  std::vector<int64_t> key_pts;
+  bool valid = true;
+  result.pts.clear();
+  // 帧号在排序之后才知道，先记下 PTS
+  std::vector<int64_t> packet_pts;
+  const AVCRC *crc_table = av_crc_get_table(AV_CRC_32_IEEE);
+  if (packets)
+    packets->clear();
+  while (valid && av_read_frame(format_ctx, packet) >= 0) {
+    if (packet->stream_index == stream_index) {
+      if (packet->pts == AV_NOPTS_VALUE)
+        valid = false;
+      result.pts.push_back(packet->pts);
+      if (packet->flags & AV_PKT_FLAG_KEY)
+        key_pts.push_back(packet->pts);
+      if (packets) {
+        // 包数据按一行图像计算哈希
+        packets->push_back(
+            {-1, vm_ssim::hash(packet->data, packet->size, packet->size, 1),
+             av_crc(crc_table, 0, packet->data, packet->size), packet->size,
+             (packet->flags & AV_PKT_FLAG_KEY) != 0});
+        packet_pts.push_back(packet->pts);
+      }
+    }
+    av_packet_unref(packet);
+  }
+  av_packet_free(&packet);
+  avformat_close_input(&format_ctx);
+
+  std::sort(result.pts.begin(), result.pts.end());
+  if (!valid ||
+      std::adjacent_find(result.pts.begin(), result.pts.end()) !=
+          result.pts.end())
+    return false;
+
+  result.keyframes.clear();
+  for (int64_t pts : key_pts)
+    result.keyframes.push_back(result.index(pts));
+  std::sort(result.keyframes.begin(), result.keyframes.end());
+  if (packets)
+    for (size_t i = 0; i < packets->size(); ++i)
+      (*packets)[i].frame_num = result.index(packet_pts[i]);
+  return true;
+}
+
+std::vector<fnum> align(const std::vector<packet> &packets_1, fnum size_1,
+                        const std::vector<packet> &packets_2, fnum size_2) {
+  // video 2 的关键帧按哈希分组，组内按解码顺序
+  std::unordered_map<uint64_t, std::vector<size_t>> keys_2;
+  for (size_t j = 0; j < packets_2.size(); ++j)
+    if (packets_2[j].key)
+      keys_2[packets_2[j].hash].push_back(j);
+
+  std::vector<fnum> result(size_1, -1);
+  std::vector<uint8_t> used_2(size_2, 0);
+  size_t cursor = 0;
+  for (size_t i = 0; i < packets_1.size();) {
+    auto it = packets_1[i].key ? keys_2.find(packets_1[i].hash)
+                               : keys_2.end();
+    if (it == keys_2.end()) {
+      ++i;
+      continue;
+    }
+
+    // 相同的关键帧有多个时取上一段之后最近的，哈希碰撞的跳过
+    const std::vector<size_t> &starts = it->second;
+    size_t first =
+        std::lower_bound(starts.begin(), starts.end(), cursor) - starts.begin();
+    size_t j = packets_2.size();
+    for (size_t k = 0; k < starts.size() && j == packets_2.size(); ++k) {
+      size_t candidate = starts[(first + k) % starts.size()];
+      if (packets_1[i].same(packets_2[candidate]))
+        j = candidate;
+    }
+    if (j == packets_2.size()) {
+      ++i;
+      continue;
+    }
+    size_t length = 0;
+    while (i + length < packets_1.size() && j + length < packets_2.size() &&
+           packets_1[i + length].same(packets_2[j + length]))
+      ++length;
+
+    fnum key_1 = packets_1[i].frame_num, key_2 = packets_2[j].frame_num;
+    for (size_t k = 0; k < length; ++k) {
+      fnum frame_1 = packets_1[i + k].frame_num,
+           frame_2 = packets_2[j + k].frame_num;
+      if (frame_1 >= key_1 && frame_2 >= key_2 && result[frame_1] == -1 &&
+          !used_2[frame_2]) {
+        result[frame_1] = frame_2;
+        used_2[frame_2] = 1;
+      }
+    }
+    i += length;
+    cursor = j + length;
+  }
+  return result;
+}
+
+bool seek(AVFormatContext *format_ctx, AVCodecContext *codec_ctx,
+          int stream_index, const timeline &line, fnum frame_num) {
+  if (frame_num < 0 || frame_num >= line.size())
+    return true;
+
+  if (av_seek_frame(format_ctx, stream_index, line.pts[frame_num],
+                    AVSEEK_FLAG_BACKWARD) < 0) {
+    // 失败时从头解码，只是多跳过一些帧
+    vm_log::warning(std::format(
+        "vm_segment::seek: can not seek to frame {0}, decoding from the start",
+        frame_num));
+    if (avformat_seek_file(format_ctx, stream_index, INT64_MIN,
+                           line.pts.front(), line.pts.front(), 0) < 0 &&
+        avformat_seek_file(format_ctx, -1, INT64_MIN, 0, 0,
+                           AVSEEK_FLAG_BYTE) < 0) {
+      vm_log::error(std::format(
+          "vm_segment::seek: can not rewind to the start for frame {0}",
+          frame_num));
+      return false;
+    }
+  }
+  avcodec_flush_buffers(codec_ctx);
+  return true;
+}
+
+std::vector<fnum> split(const timeline &line, int count, fnum min_length) {
+  std::vector<fnum> starts{0};
+  for (int i = 1; i < count; ++i) {
+    fnum target = static_cast<fnum>(static_cast<int64_t>(line.size()) * i /
+                                    count);
+    auto key = std::lower_bound(line.keyframes.begin(), line.keyframes.end(),
+                                std::max(target, starts.back() + min_length));
+    if (key == line.keyframes.end() || line.size() - *key < min_length)
+      break;
+    starts.push_back(*key);
+  }
+  return starts;
+}
+
+} // namespace vm_segment
@@ -0,0 +1,69 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vm_type.hpp"
+
+namespace vm_segment {
+
+// 只解封装得到的视频流时间线，用于按 PTS 换算帧号和定位关键帧
+struct timeline {
+  std::vector<int64_t> pts;    // 显示顺序
+  std::vector<fnum> keyframes; // 关键帧帧号，升序
+  AVRational time_base{0, 1};  // pts 的单位
+
+  fnum size() const { return static_cast<fnum>(pts.size()); }
+
+  // PTS 对应的帧号，不在时间线上时返回 -1
+  fnum index(int64_t frame_pts) const;
+
+  // 帧 frame_num 相对第一帧的秒数，超出范围时取最近的帧
+  double time(fnum frame_num) const;
+
+  // 时间最接近 seconds 的帧，时间线为空时返回 0
+  fnum at(double seconds) const;
+};
+
+// 视频流的一个包，按解码顺序排列
+// 对齐时哈希、CRC 与大小全部相同才视为相同的包，避免单个哈希碰撞
+struct packet {
+  fnum frame_num; // 显示顺序的帧号
+  uint64_t hash;  // 包数据的哈希
+  uint32_t crc;   // 包数据的 CRC-32，与 hash 相互独立
+  int size;
+  bool key;
+
+  bool same(const packet &other) const {
+    return hash == other.hash && crc == other.crc && size == other.size;
+  }
+};
+
+// 读取视频流的全部包建立时间线，PTS 缺失或重复时返回 false
+// packets 不为 nullptr 时同时记录各包的哈希与 CRC
+bool scan(const std::string &path, int stream_index, timeline &result,
+          std::vector<packet> *packets = nullptr);
+
+// 按包内容对齐两个视频，返回 video 1 每帧在 video 2 中的帧号，-1 为未对齐
+// 从两边相同的关键帧开始，解码顺序上连续相同的包解码出的帧也相同
+// 显示在起点关键帧之前的帧可能参考更早的包，不计入
+// 每个 video 2 的帧至多对齐一次
+std::vector<fnum> align(const std::vector<packet> &packets_1, fnum size_1,
+                        const std::vector<packet> &packets_2, fnum size_2);
+
+// 定位到 frame_num 之前最近的关键帧，无法定位时回到开头
+// 之后解码出的帧仍需按时间线换算帧号，跳过 frame_num 之前的帧
+// 连开头也回不去时返回 false，此时读取位置不变
+bool seek(AVFormatContext *format_ctx, AVCodecContext *codec_ctx,
+          int stream_index, const timeline &line, fnum frame_num);
+
+// 在关键帧处把视频切成至多 count 段，每段不短于 min_length，返回各段起点
+std::vector<fnum> split(const timeline &line, int count, fnum min_length);
+
+} // namespace vm_segment
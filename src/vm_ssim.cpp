@@ -0,0 +1,316 @@
+#include "vm_ssim.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "vm_cpu.hpp"
+
+#if VM_X86
+#include <immintrin.h>
+#endif
+
+namespace vm_ssim {
+
+// 每个 4x4 块的 {s1, s2, ss, s12}
+using block_sum = std::array<int, 4>;
+
+void _4x4_line_c(const uint8_t *main, int main_linesize, const uint8_t *ref,
+                 int ref_linesize, block_sum *sums, int begin, int end) {
+  for (int z = begin; z < end; ++z) {
+    int s1 = 0, s2 = 0, ss = 0, s12 = 0;
+    for (int y = 0; y < 4; ++y) {
+      const uint8_t *a =
+          main + static_cast<ptrdiff_t>(y) * main_linesize + 4 * z;
+      const uint8_t *b = ref + static_cast<ptrdiff_t>(y) * ref_linesize + 4 * z;
+      for (int x = 0; x < 4; ++x) {
+        s1 += a[x];
+        s2 += b[x];
+        ss += a[x] * a[x] + b[x] * b[x];
+        s12 += a[x] * b[x];
+      }
+    }
+    sums[z] = {s1, s2, ss, s12};
+  }
+}
+
+#if VM_X86
+VM_TARGET("sse4.1")
+void _4x4_line_sse41(const uint8_t *main, int main_linesize,
+                     const uint8_t *ref, int ref_linesize, block_sum *sums,
+                     int width) {
+  const __m128i ones = _mm_set1_epi16(1);
+  int simd_width = width & ~1;
+  for (int z = 0; z < simd_width; z += 2) {
+    __m128i sa = _mm_setzero_si128(), sb = _mm_setzero_si128();
+    __m128i ss = _mm_setzero_si128(), s12 = _mm_setzero_si128();
+    for (int y = 0; y < 4; ++y) {
+      __m128i a = _mm_cvtepu8_epi16(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(
+              main + static_cast<ptrdiff_t>(y) * main_linesize + 4 * z)));
+      __m128i b = _mm_cvtepu8_epi16(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(
+              ref + static_cast<ptrdiff_t>(y) * ref_linesize + 4 * z)));
+      sa = _mm_add_epi16(sa, a);
+      sb = _mm_add_epi16(sb, b);
+      ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(a, a),
+                                           _mm_madd_epi16(b, b)));
+      s12 = _mm_add_epi32(s12, _mm_madd_epi16(a, b));
+    }
+    // v0 = {s1 块0, s1 块1, s2 块0, s2 块1}, v1 = {ss ..., s12 ...}
+    __m128i v0 = _mm_hadd_epi32(_mm_madd_epi16(sa, ones),
+                                _mm_madd_epi16(sb, ones));
+    __m128i v1 = _mm_hadd_epi32(ss, s12);
+    __m128i t0 = _mm_unpacklo_epi32(v0, v1), t1 = _mm_unpackhi_epi32(v0, v1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums[z].data()),
+                     _mm_unpacklo_epi32(t0, t1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums[z + 1].data()),
+                     _mm_unpackhi_epi32(t0, t1));
+  }
+  _4x4_line_c(main, main_linesize, ref, ref_linesize, sums, simd_width, width);
+}
+
+VM_TARGET("avx2")
+void _4x4_line_avx2(const uint8_t *main, int main_linesize, const uint8_t *ref,
+                    int ref_linesize, block_sum *sums, int width) {
+  const __m256i ones = _mm256_set1_epi16(1);
+  int simd_width = width & ~3;
+  for (int z = 0; z < simd_width; z += 4) {
+    __m256i sa = _mm256_setzero_si256(), sb = _mm256_setzero_si256();
+    __m256i ss = _mm256_setzero_si256(), s12 = _mm256_setzero_si256();
+    for (int y = 0; y < 4; ++y) {
+      __m256i a = _mm256_cvtepu8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+              main + static_cast<ptrdiff_t>(y) * main_linesize + 4 * z)));
+      __m256i b = _mm256_cvtepu8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+              ref + static_cast<ptrdiff_t>(y) * ref_linesize + 4 * z)));
+      sa = _mm256_add_epi16(sa, a);
+      sb = _mm256_add_epi16(sb, b);
+      ss = _mm256_add_epi32(ss, _mm256_add_epi32(_mm256_madd_epi16(a, a),
+                                                 _mm256_madd_epi16(b, b)));
+      s12 = _mm256_add_epi32(s12, _mm256_madd_epi16(a, b));
+    }
+    // 与 SSE4.1 相同的排列，低 128 bit 为块 0 1，高 128 bit 为块 2 3
+    __m256i v0 = _mm256_hadd_epi32(_mm256_madd_epi16(sa, ones),
+                                   _mm256_madd_epi16(sb, ones));
+    __m256i v1 = _mm256_hadd_epi32(ss, s12);
+    __m256i t0 = _mm256_unpacklo_epi32(v0, v1),
+            t1 = _mm256_unpackhi_epi32(v0, v1);
+    __m256i r0 = _mm256_unpacklo_epi32(t0, t1),
+            r1 = _mm256_unpackhi_epi32(t0, t1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(sums[z].data()),
+                        _mm256_permute2x128_si256(r0, r1, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(sums[z + 2].data()),
+                        _mm256_permute2x128_si256(r0, r1, 0x31));
+  }
+  _4x4_line_c(main, main_linesize, ref, ref_linesize, sums, simd_width, width);
+}
+#endif
+
+void _4x4_line_scalar(const uint8_t *main, int main_linesize,
+                      const uint8_t *ref, int ref_linesize, block_sum *sums,
+                      int width) {
+  _4x4_line_c(main, main_linesize, ref, ref_linesize, sums, 0, width);
+}
+
+using _4x4_line_fn = void (*)(const uint8_t *, int, const uint8_t *, int,
+                              block_sum *, int);
+
+_4x4_line_fn _select_4x4_line() {
+#if VM_X86
+  switch (vm_cpu::detect()) {
+  case vm_cpu::simd_level::avx2:
+    return _4x4_line_avx2;
+  case vm_cpu::simd_level::sse41:
+    return _4x4_line_sse41;
+  default:
+    break;
+  }
+#endif
+  return _4x4_line_scalar;
+}
+
+// 8 bit 版本的常量与公式，同 libavfilter/vf_ssim.c
+const int ssim_c1 = static_cast<int>(.01 * .01 * 255 * 255 * 64 + .5);
+
+float _end1(int s1, int s2, int ss, int s12) {
+  static const int ssim_c2 =
+      static_cast<int>(.03 * .03 * 255 * 255 * 64 * 63 + .5);
+
+  int vars = ss * 64 - s1 * s1 - s2 * s2;
+  int covar = s12 * 64 - s1 * s2;
+
+  return static_cast<float>(2 * s1 * s2 + ssim_c1) *
+         static_cast<float>(2 * covar + ssim_c2) /
+         (static_cast<float>(s1 * s1 + s2 * s2 + ssim_c1) *
+          static_cast<float>(vars + ssim_c2));
+}
+
+float _end_line(const block_sum *sum0, const block_sum *sum1, int width) {
+  float ssim = 0;
+  for (int i = 0; i < width; ++i)
+    ssim += _end1(sum0[i][0] + sum0[i + 1][0] + sum1[i][0] + sum1[i + 1][0],
+                  sum0[i][1] + sum0[i + 1][1] + sum1[i][1] + sum1[i + 1][1],
+                  sum0[i][2] + sum0[i + 1][2] + sum1[i][2] + sum1[i + 1][2],
+                  sum0[i][3] + sum0[i + 1][3] + sum1[i][3] + sum1[i + 1][3]);
+  return ssim;
+}
+
+double ssim(const uint8_t *main, int main_linesize, const uint8_t *ref,
+            int ref_linesize, int width, int height) {
+  static const _4x4_line_fn line_4x4 = _select_4x4_line();
+  thread_local std::vector<block_sum> temp;
+
+  width >>= 2;
+  height >>= 2;
+  if (width < 2 || height < 2)
+    return -1;
+
+  temp.resize(2 * static_cast<size_t>(width));
+  block_sum *sum0 = temp.data(), *sum1 = sum0 + width;
+
+  double ssim = 0;
+  for (int y = 1, z = 0; y < height; ++y) {
+    for (; z <= y; ++z) {
+      std::swap(sum0, sum1);
+      line_4x4(main + static_cast<ptrdiff_t>(4) * z * main_linesize,
+               main_linesize,
+               ref + static_cast<ptrdiff_t>(4) * z * ref_linesize,
+               ref_linesize, sum0, width);
+    }
+    ssim += _end_line(sum0, sum1, width - 1);
+  }
+
+  return ssim / ((height - 1) * (width - 1));
+}
+
+// 第 i 个格子包含的窗口行 (列) 数，窗口 p 属于格子 p * cells / windows
+int _cell_span(int i, int windows, int cells) {
+  auto first = [&](int k) { return (k * windows + cells - 1) / cells; };
+  return first(i + 1) - first(i);
+}
+
+void compute_signature(const uint8_t *data, int linesize, int width,
+                       int height, signature &sig) {
+  thread_local std::vector<int> blocks;
+
+  int block_width = width >> 2, block_height = height >> 2;
+  int window_width = block_width - 1, window_height = block_height - 1;
+  sig.window_width = std::max(0, window_width);
+  sig.window_height = std::max(0, window_height);
+  sig.grid_width = std::min(signature::grid, sig.window_width);
+  sig.grid_height = std::min(signature::grid, sig.window_height);
+  std::fill_n(sig.mean, signature::grid * signature::grid, 0);
+  std::fill_n(sig.max, signature::grid * signature::grid, 0);
+  if (window_width < 1 || window_height < 1)
+    return;
+
+  // 4x4 块像素和
+  blocks.assign(static_cast<size_t>(block_width) * block_height, 0);
+  for (int y = 0; y < block_height * 4; ++y) {
+    const uint8_t *row = data + static_cast<ptrdiff_t>(y) * linesize;
+    int *block_row = blocks.data() + static_cast<size_t>(y >> 2) * block_width;
+    for (int x = 0; x < block_width; ++x)
+      block_row[x] += row[4 * x] + row[4 * x + 1] + row[4 * x + 2] +
+                      row[4 * x + 3];
+  }
+
+  // 8x8 窗口像素和，按所在格子累计
+  std::array<int64_t, signature::grid * signature::grid> sum{};
+  for (int y = 0; y < window_height; ++y) {
+    const int *b0 = blocks.data() + static_cast<size_t>(y) * block_width;
+    const int *b1 = b0 + block_width;
+    int cell_row = y * sig.grid_height / window_height * sig.grid_width;
+    for (int x = 0; x < window_width; ++x) {
+      int s = b0[x] + b0[x + 1] + b1[x] + b1[x + 1];
+      int cell = cell_row + x * sig.grid_width / window_width;
+      sum[cell] += s;
+      sig.max[cell] = static_cast<uint16_t>(std::max<int>(sig.max[cell], s));
+    }
+  }
+
+  // 均值 * 4 四舍五入
+  for (int cy = 0; cy < sig.grid_height; ++cy)
+    for (int cx = 0; cx < sig.grid_width; ++cx) {
+      int64_t count = static_cast<int64_t>(
+                          _cell_span(cx, window_width, sig.grid_width)) *
+                      _cell_span(cy, window_height, sig.grid_height);
+      int cell = cy * sig.grid_width + cx;
+      sig.mean[cell] =
+          static_cast<uint16_t>((4 * sum[cell] + count / 2) / count);
+    }
+}
+
+double upper_bound(const signature &a, const signature &b) {
+  if (a.window_width != b.window_width ||
+      a.window_height != b.window_height || !a.window_width ||
+      !a.window_height)
+    return 1;
+
+  double penalty = 0;
+  for (int cy = 0; cy < a.grid_height; ++cy) {
+    int rows = _cell_span(cy, a.window_height, a.grid_height);
+    for (int cx = 0; cx < a.grid_width; ++cx) {
+      int cell = cy * a.grid_width + cx;
+      // 真实均值与 mean / 4 相差不超过 1/8
+      int diff = std::abs(a.mean[cell] - b.mean[cell]) - 1;
+      if (diff <= 0)
+        continue;
+      double count = static_cast<double>(rows) *
+                     _cell_span(cx, a.window_width, a.grid_width);
+      double mean_diff = diff / 4.0;
+      double max_a = a.max[cell], max_b = b.max[cell];
+      penalty += count * mean_diff * mean_diff /
+                 (max_a * max_a + max_b * max_b + ssim_c1);
+    }
+  }
+  return 1 - penalty /
+                 (static_cast<double>(a.window_width) * a.window_height);
+}
+
+// xxHash64 的 4 路累加与收尾混合，行尾不足 32 字节的部分并入第 5 路
+uint64_t hash(const uint8_t *data, int linesize, int width, int height) {
+  constexpr uint64_t prime_1 = 0x9E3779B185EBCA87ULL;
+  constexpr uint64_t prime_2 = 0xC2B2AE3D27D4EB4FULL;
+  constexpr uint64_t prime_3 = 0x165667B19E3779F9ULL;
+  auto round = [](uint64_t acc, uint64_t value) {
+    return std::rotl(acc + value * prime_2, 31) * prime_1;
+  };
+  auto load = [](const uint8_t *p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+  };
+
+  uint64_t lane[4] = {prime_1 + prime_2, prime_2, 0, 0 - prime_1};
+  uint64_t tail = prime_3 ^ (static_cast<uint64_t>(width) << 32 |
+                             static_cast<uint32_t>(height));
+  for (int y = 0; y < height; ++y) {
+    const uint8_t *row = data + static_cast<ptrdiff_t>(y) * linesize;
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+      for (int k = 0; k < 4; ++k)
+        lane[k] = round(lane[k], load(row + x + 8 * k));
+    for (; x + 8 <= width; x += 8)
+      tail = round(tail, load(row + x));
+    for (; x < width; ++x)
+      tail = round(tail, row[x]);
+  }
+
+  uint64_t h = std::rotl(lane[0], 1) + std::rotl(lane[1], 7) +
+               std::rotl(lane[2], 12) + std::rotl(lane[3], 18);
+  h = (h ^ round(0, tail)) * prime_1;
+  h ^= h >> 33;
+  h *= prime_2;
+  h ^= h >> 29;
+  h *= prime_3;
+  h ^= h >> 32;
+  return h;
+}
+
+} // namespace vm_ssim
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+namespace vm_ssim {
+
+// 计算两幅 GRAY8 图像的 SSIM
+// 与 libavfilter ssim 滤镜的 Y 分量算法一致: 4x4 块求和, 8x8 窗口, 步长 4
+// 根据 CPU 在运行时选择 AVX2 / SSE4.1 / 标量实现，可多线程同时调用
+double ssim(const uint8_t *main, int main_linesize, const uint8_t *ref,
+            int ref_linesize, int width, int height);
+
+// 预筛选签名: 把 8x8 窗口划分为最多 16x16 个格子，记录每格窗口像素和的均值与最大值
+// 窗口像素和不超过 64 * 255，均值以 1/4 为单位取整，均可用 16 位保存
+// 每格的窗口数由窗口与格子的行列数得出，不保存
+// 只由单帧计算，可在解码时算好
+struct signature {
+  static constexpr int grid = 16;
+
+  int32_t window_width = 0, window_height = 0;
+  int32_t grid_width = 0, grid_height = 0;
+  uint16_t mean[grid * grid];
+  uint16_t max[grid * grid];
+};
+
+void compute_signature(const uint8_t *data, int linesize, int width,
+                       int height, signature &sig);
+
+// 由两帧签名得到 ssim() 的上界
+// 每个窗口 SSIM 不超过其亮度项 l = (2 s1 s2 + c1) / (s1^2 + s2^2 + c1)，
+// 格内用最大窗口和放大分母、用 Cauchy-Schwarz 合并差值，得到保守上界
+// 均值的差减去两边取整误差之和，取整后仍是上界
+double upper_bound(const signature &a, const signature &b);
+
+// GRAY8 图像的 64 位内容哈希，只含每行前 width 字节，与 linesize 无关
+// 哈希相同视为像素完全相同，此时 ssim() 为 1
+uint64_t hash(const uint8_t *data, int linesize, int width, int height);
+
+} // namespace vm_ssim
@@ -0,0 +1,134 @@
+#include "vm_stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <format>
+#include <fstream>
+
+#include "vm_log.hpp"
+#include "vm_utils.hpp"
+
+namespace vm_stats {
+
+bool enabled = false;
+
+namespace {
+
+constexpr const char *stage_names[] = {"demux_1", "demux_2", "decode_1",
+                                       "decode_2", "scale",   "window",
+                                       "coarse",  "ssim",    "output"};
+static_assert(std::size(stage_names) == static_cast<size_t>(stage::count));
+
+constexpr const char *counter_names[] = {
+    "frames_1", "matched",     "frames_2",     "compare",        "prune",
+    "coarse",   "first_probe", "forward_grow", "forward_shrink", "resync",
+    "exact",    "packet"};
+static_assert(std::size(counter_names) == static_cast<size_t>(counter::count));
+
+// 桶 0 为位置 0，桶 k 为 [2^(k-1), 2^k)
+constexpr size_t hit_buckets = 64;
+
+struct _stage_data {
+  std::atomic<uint64_t> ns, calls;
+};
+
+std::array<_stage_data, static_cast<size_t>(stage::count)> stages;
+std::array<std::atomic<uint64_t>, static_cast<size_t>(counter::count)>
+    counters;
+std::array<std::atomic<uint64_t>, hit_buckets> hits;
+std::atomic<int64_t> window_frames_now, window_bytes_now;
+std::atomic<int64_t> window_frames_peak, window_bytes_peak;
+
+void _raise(std::atomic<int64_t> &peak, int64_t value) {
+  for (int64_t cur = peak.load();
+       value > cur && !peak.compare_exchange_weak(cur, value);)
+    ;
+}
+
+} // namespace
+
+void reset() {
+  for (_stage_data &data : stages)
+    data.ns = data.calls = 0;
+  for (auto &value : counters)
+    value = 0;
+  for (auto &value : hits)
+    value = 0;
+  window_frames_now = window_bytes_now = 0;
+  window_frames_peak = window_bytes_peak = 0;
+}
+
+void add(counter c, uint64_t n) {
+  counters[static_cast<size_t>(c)].fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t get(counter c) { return counters[static_cast<size_t>(c)].load(); }
+
+void add(stage s, std::chrono::nanoseconds time) {
+  _stage_data &data = stages[static_cast<size_t>(s)];
+  data.ns.fetch_add(time.count(), std::memory_order_relaxed);
+  data.calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void hit(size_t position) {
+  hits[std::bit_width(position)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void window_fill(int64_t frames, int64_t bytes) {
+  _raise(window_frames_peak, window_frames_now += frames);
+  _raise(window_bytes_peak, window_bytes_now += bytes);
+}
+
+int64_t window_frames() { return window_frames_now.load(); }
+
+void write(const std::string &path, double seconds) {
+  std::ofstream file(vm_utils::utf8_to_path(path));
+  if (!file) {
+    vm_log::error(std::format("Can not open the stats file \"{0}\"", path));
+    return;
+  }
+
+  std::string text = std::format("{{\n  \"seconds\": {0:.3f},\n", seconds);
+
+  text += "  \"stages\": {";
+  for (size_t i = 0; i < stages.size(); ++i)
+    text += std::format(R"({0}"{1}": {{"seconds": {2:.6f}, "calls": {3}}})",
+                        i ? ",\n    " : "\n    ", stage_names[i],
+                        stages[i].ns * 1e-9, stages[i].calls.load());
+  text += "\n  },\n";
+
+  text += "  \"counters\": {";
+  for (size_t i = 0; i < counters.size(); ++i)
+    text += std::format(R"({0}"{1}": {2})", i ? ", " : "", counter_names[i],
+                        counters[i].load());
+  text += "},\n";
+
+  uint64_t frames = std::max<uint64_t>(1, get(counter::frames_1));
+  text += std::format(
+      "  \"comparisons_per_frame\": {0:.3f},\n",
+      static_cast<double>(get(counter::compare)) / frames);
+
+  // 只写到最后一个非空桶
+  size_t used = hits.size();
+  while (used && !hits[used - 1])
+    --used;
+  text += "  \"hit_position\": [";
+  for (size_t i = 0; i < used; ++i)
+    text += std::format(
+        R"({0}{{"begin": {1}, "end": {2}, "frames": {3}}})",
+        i ? ",\n    " : "\n    ", i ? size_t(1) << (i - 1) : 0,
+        i ? (size_t(1) << i) - 1 : 0, hits[i].load());
+  text += used ? "\n  ],\n" : "],\n";
+
+  text += std::format(
+      "  \"window\": {{\"peak_frames\": {0}, \"peak_bytes\": {1}}}\n}}\n",
+      window_frames_peak.load(), window_bytes_peak.load());
+
+  file << text;
+  if (!file)
+    vm_log::error(std::format("Failed to write the stats file \"{0}\"", path));
+}
+
+} // namespace vm_stats
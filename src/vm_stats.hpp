@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace vm_stats {
+
+// 计时的阶段，各线程的耗时累加
+enum class stage {
+  demux_1,  // av_read_frame
+  demux_2,
+  decode_1, // avcodec_send_packet + avcodec_receive_frame
+  decode_2,
+  scale,    // 转灰度、缩放、签名与粗筛层
+  window,   // 读入 video 2 并移除旧帧，含等待解码的时间
+  coarse,   // -pyramid 粗筛层 SSIM
+  ssim,
+  output,
+  count
+};
+
+// 计数，-stats 未开启时同样计数
+enum class counter {
+  frames_1,       // 已得出结果的 video 1 帧
+  matched,        // 其中找到匹配的帧
+  frames_2,       // 放入窗口的 video 2 帧
+  compare,        // SSIM 对比次数
+  prune,          // 被预筛选跳过的对比
+  coarse,         // 粗筛层对比次数
+  first_probe,    // 首个探测候选即命中的帧
+  forward_grow,   // 自适应窗口变大的次数
+  forward_shrink, // 自适应窗口变小的次数
+  resync,         // -resync 跳转次数
+  exact,          // 窗口中有像素完全相同的帧，免去其 SSIM 的匹配
+  packet,         // -packet 按包哈希对齐、不经解码得出的匹配
+  count
+};
+
+// -stats 开启时才计时，匹配开始前设置
+extern bool enabled;
+
+// 清零全部数据
+void reset();
+
+void add(counter c, uint64_t n = 1);
+uint64_t get(counter c);
+
+void add(stage s, std::chrono::nanoseconds time);
+
+// 作用域内的耗时计入 s
+class timer {
+public:
+  explicit timer(stage s) : s(s) {
+    if (enabled)
+      start = std::chrono::steady_clock::now();
+  }
+  ~timer() {
+    if (enabled)
+      add(s, std::chrono::steady_clock::now() - start);
+  }
+
+  timer(const timer &) = delete;
+  timer &operator=(const timer &) = delete;
+
+private:
+  stage s;
+  std::chrono::steady_clock::time_point start;
+};
+
+// 匹配帧在探测顺序中的位置，按 2 的幂分桶
+void hit(size_t position);
+
+// 所有窗口中帧数与字节数的变化，记录峰值
+void window_fill(int64_t frames, int64_t bytes);
+int64_t window_frames();
+
+// 写出 JSON 报告，seconds 为总耗时
+void write(const std::string &path, double seconds);
+
+} // namespace vm_stats
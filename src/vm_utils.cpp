@@ -1,7 +1,10 @@
 extern "C" {
 #include <libavutil/error.h>
 }
+#ifdef _WIN32
 #include <Windows.h>
+#endif
+#include <cstring>
 #include <string>
 #include <unordered_map>
 
@@ -63,6 +66,7 @@ std::string ff_err_to_str(int errorCode) {
 }
 
 std::string ansi_to_utf8(const char *ansi_str) {
+#ifdef _WIN32
   // 1. ANSI → UTF-16（不自动添加 \0）
   int wlen =
       MultiByteToWideChar(CP_ACP, 0, ansi_str, strlen(ansi_str), nullptr, 0);
@@ -77,6 +81,20 @@ std::string ansi_to_utf8(const char *ansi_str) {
                       nullptr, nullptr);
 
   return utf8_str;
+#else
+  // 其他系统的命令行参数已是 UTF-8
+  return ansi_str;
+#endif
+}
+
+std::filesystem::path utf8_to_path(const std::string &utf8_str) {
+  return std::filesystem::path(
+      std::u8string(utf8_str.begin(), utf8_str.end()));
+}
+
+std::string path_to_utf8(const std::filesystem::path &path) {
+  std::u8string utf8_str = path.u8string();
+  return std::string(utf8_str.begin(), utf8_str.end());
 }
 
 } // namespace vm_utils
\ No newline at end of file
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <filesystem>
 #include <string>
 
 namespace vm_utils {
 
 std::string ff_err_to_str(int errorCode);
 std::string ansi_to_utf8(const char *ansi_str);
+std::filesystem::path utf8_to_path(const std::string &utf8_str);
+std::string path_to_utf8(const std::filesystem::path &path);
 
 } // namespace vm_utils
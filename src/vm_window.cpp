@@ -0,0 +1,155 @@
+#include "vm_window.hpp"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <format>
+#include <new>
+
+#include "vm_log.hpp"
+#include "vm_scale.hpp"
+
+namespace vm_window {
+
+constexpr size_t arena_align = 64;
+
+// 不带引用计数的 GRAY8 帧，释放帧时不会释放 arena
+AVFrame *_arena_frame(uint8_t *data, int width, int height, int linesize) {
+  AVFrame *gray = av_frame_alloc();
+  if (!gray)
+    vm_log::errore("vm_window::_arena_frame: av_frame_alloc: error");
+  gray->width = width;
+  gray->height = height;
+  gray->format = AV_PIX_FMT_GRAY8;
+  gray->data[0] = data;
+  gray->linesize[0] = linesize;
+  return gray;
+}
+
+int _aligned_linesize(int width) {
+  return static_cast<int>((width + arena_align - 1) & ~(arena_align - 1));
+}
+
+size_t window::frame_bytes(int width, int height, int coarse_width,
+                          int coarse_height) {
+  return static_cast<size_t>(_aligned_linesize(width)) * height +
+         static_cast<size_t>(_aligned_linesize(coarse_width)) * coarse_height;
+}
+
+window::window(size_t capacity, int width, int height, int coarse_width,
+               int coarse_height)
+    : slots(capacity), buckets(std::bit_ceil(2 * capacity), -1),
+      width(width), height(height),
+      coarse_width(coarse_width), coarse_height(coarse_height) {
+  int linesize = _aligned_linesize(width);
+  int coarse_linesize = _aligned_linesize(coarse_width);
+  size_t gray_size = static_cast<size_t>(linesize) * height;
+  slot_size = frame_bytes(width, height, coarse_width, coarse_height);
+  arena = static_cast<uint8_t *>(
+      ::operator new(slot_size * capacity, std::align_val_t(arena_align)));
+
+  for (size_t i = 0; i < capacity; ++i) {
+    uint8_t *data = arena + slot_size * i;
+    slots[i].frame = std::make_unique<vm_frame::frame>(
+        _arena_frame(data, width, height, linesize), vm_ssim::signature{});
+    if (coarse_width)
+      slots[i].frame->coarse = _arena_frame(data + gray_size, coarse_width,
+                                            coarse_height, coarse_linesize);
+  }
+}
+
+window::~window() {
+  slots.clear();
+  ::operator delete(arena, std::align_val_t(arena_align));
+}
+
+bool window::same_layout(size_t capacity, int width, int height,
+                         int coarse_width, int coarse_height) const {
+  return capacity == slots.size() && width == this->width &&
+         height == this->height && coarse_width == this->coarse_width &&
+         coarse_height == this->coarse_height;
+}
+
+void window::clear() {
+  begin_num = end_num = 0;
+  std::fill(buckets.begin(), buckets.end(), -1);
+}
+
+void window::push(fnum num, const vm_frame::frame &frame) {
+  if (begin_num == end_num) {
+    // 哈希链要求帧号递增，向前跳转时丢弃旧链
+    if (num < end_num)
+      std::fill(buckets.begin(), buckets.end(), -1);
+    begin_num = end_num = num;
+  }
+  if (num != end_num || static_cast<size_t>(end_num - begin_num) >= capacity())
+    vm_log::errore(std::format(
+        "vm_window::push: frame {0} does not fit in window [{1}, {2})", num,
+        begin_num, end_num));
+
+  slot &s = _slot(num);
+  AVFrame *gray = s.frame->gray;
+  av_image_copy_plane(gray->data[0], gray->linesize[0], frame.gray->data[0],
+                      frame.gray->linesize[0], gray->width, gray->height);
+  s.frame->sig = frame.sig;
+  s.frame->hash = frame.hash;
+  fnum &head = buckets[_bucket(frame.hash)];
+  s.next = head;
+  head = num;
+
+  if (AVFrame *coarse = s.frame->coarse) {
+    if (frame.coarse)
+      av_image_copy_plane(coarse->data[0], coarse->linesize[0],
+                          frame.coarse->data[0], frame.coarse->linesize[0],
+                          coarse->width, coarse->height);
+    else
+      vm_scale::box_downscale(gray->data[0], gray->linesize[0],
+                              coarse->data[0], coarse->linesize[0],
+                              coarse->width, coarse->height,
+                              gray->width / coarse->width);
+  }
+  s.consumed = false;
+  ++end_num;
+}
+
+vm_frame::frame *window::find(fnum num) {
+  if (num < begin_num || num >= end_num)
+    return nullptr;
+  slot &s = _slot(num);
+  return s.consumed ? nullptr : s.frame.get();
+}
+
+fnum window::find_hash(uint64_t hash, fnum predict) const {
+  fnum result = -1;
+  int64_t best = 0;
+  // 链上帧号递减，小于 begin() 的已移出窗口，其后的也一样
+  for (fnum num = buckets[_bucket(hash)]; num >= begin_num;) {
+    const slot &s = _slot(num);
+    if (!s.consumed && s.frame->hash == hash) {
+      int64_t distance = std::abs(static_cast<int64_t>(num) - predict);
+      int64_t order = 2 * distance - (num > predict);
+      if (result == -1 || order < best) {
+        result = num;
+        best = order;
+      }
+    }
+    if (s.next >= num)
+      break;
+    num = s.next;
+  }
+  return result;
+}
+
+void window::consume(fnum num) {
+  if (num >= begin_num && num < end_num)
+    _slot(num).consumed = true;
+}
+
+void window::retire_before(fnum num) {
+  begin_num = std::clamp(num, begin_num, end_num);
+}
+
+} // namespace vm_window
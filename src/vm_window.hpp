@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "vm_frame.hpp"
+#include "vm_type.hpp"
+
+namespace vm_window {
+
+// video 2 的滑动窗口，保存帧号连续的 [begin, end) 区间
+// 槽位为 frame_num % capacity 的环形数组
+// 像素存放在一次性分配的 64 字节对齐区域中
+// 插入 查找 移除均为 O(1)，运行中不再分配内存
+// 另有按内容哈希分桶的链表，桶内帧号递减，用于查找完全相同的帧
+class window {
+public:
+  // coarse_width 为 0 时不保存 -pyramid 粗筛层
+  window(size_t capacity, int width, int height, int coarse_width = 0,
+         int coarse_height = 0);
+  ~window();
+
+  window(const window &) = delete;
+  window &operator=(const window &) = delete;
+
+  fnum begin() const { return begin_num; }
+  fnum end() const { return end_num; }
+  size_t capacity() const { return slots.size(); }
+  // 每帧占用的像素字节数
+  size_t frame_bytes() const { return slot_size; }
+  // 按这些参数构造的窗口每帧占用的字节数
+  static size_t frame_bytes(int width, int height, int coarse_width = 0,
+                            int coarse_height = 0);
+  // 与按这些参数构造的窗口是否可以互换
+  bool same_layout(size_t capacity, int width, int height, int coarse_width,
+                   int coarse_height) const;
+
+  // 在 end() 处插入一帧，拷贝像素、签名与哈希，帧没有粗筛层时在此生成
+  void push(fnum num, const vm_frame::frame &frame);
+
+  // 未被消耗的帧，不存在时返回 nullptr
+  vm_frame::frame *find(fnum num);
+
+  // 哈希为 hash 且未被消耗的帧中按探测顺序最靠前的
+  // 探测顺序为 predict, predict + 1, predict - 1, predict + 2, ...
+  // 没有时返回 -1
+  fnum find_hash(uint64_t hash, fnum predict) const;
+
+  // 标记已匹配，之后不再作为候选
+  void consume(fnum num);
+
+  // 移除帧号小于 num 的帧
+  void retire_before(fnum num);
+
+  void clear();
+
+private:
+  struct slot {
+    std::unique_ptr<vm_frame::frame> frame;
+    bool consumed = false;
+    // 同一哈希桶中前一个放入的帧号，-1 为没有
+    fnum next = -1;
+  };
+
+  slot &_slot(fnum num) {
+    return slots[static_cast<size_t>(num) % slots.size()];
+  }
+  const slot &_slot(fnum num) const {
+    return slots[static_cast<size_t>(num) % slots.size()];
+  }
+  size_t _bucket(uint64_t hash) const {
+    return static_cast<size_t>(hash) & (buckets.size() - 1);
+  }
+
+  std::vector<slot> slots;
+  // 每桶最后放入的帧号，桶数为 2 的幂
+  std::vector<fnum> buckets;
+  uint8_t *arena = nullptr;
+  size_t slot_size = 0;
+  int width, height, coarse_width, coarse_height;
+  fnum begin_num = 0, end_num = 0;
+};
+
+} // namespace vm_window